@@ -1,59 +1,249 @@
-#include <cstdlib>
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <execution>
+#include <functional>
 #include <map>
 #include <mutex>
+#include <numeric>
+#include <optional>
+#include <queue>
+#include <shared_mutex>
 #include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
-#include "log_duration.h"
-//#include "test_framework.h"
-
 using namespace std::string_literals;
 
+// Hash map split into buckets, each with its own lock and its own open-addressing table.
+// Readers of a bucket share its lock, writers take it alone; buckets sit on separate cache lines,
+// so threads working on different buckets do not slow each other down
 template <typename Key, typename Value>
 class ConcurrentMap {
 private:
-    struct Bucket {
-        std::mutex mutex;
-        std::map<Key, Value> map;
+    struct alignas(64) Bucket {
+        mutable std::shared_mutex mutex;
+        // linear probing; the size is zero or a power of two, and at most three quarters of the slots are taken
+        std::vector<std::optional<std::pair<Key, Value>>> slots;
+        size_t size = 0;
     };
 
 public:
     static_assert(std::is_integral_v<Key>, "ConcurrentMap supports only integer keys"s);
 
+    // Holds the bucket of the value locked for writing
     struct Access {
-        std::lock_guard<std::mutex> guard;
+        std::unique_lock<std::shared_mutex> guard;
         Value& ref_to_value;
-
-        Access(const Key& key, Bucket& bucket)
-            : guard(bucket.mutex)
-            , ref_to_value(bucket.map[key]) {
-        }
     };
 
+    // bucket_count is rounded up to a power of two
     explicit ConcurrentMap(size_t bucket_count)
-        : buckets_(bucket_count) {
+        : buckets_(RoundUpToPowerOfTwo(bucket_count)) {
     }
 
+    // A missing value is value-initialized
     Access operator[](const Key& key) {
-        auto& bucket = buckets_[static_cast<uint64_t>(key) % buckets_.size()];
-        return { key, bucket };
+        return TryEmplace(key);
     }
-    
-    std::map<Key, Value> BuildOrdinaryMap() {
-        std::map<Key, Value> result;
-        for (auto& [mutex, map] : buckets_) {
-            std::lock_guard g(mutex);
-            result.insert(map.begin(), map.end());
+
+    // A missing value is constructed from args, an existing one is left as it is
+    template <typename... Args>
+    Access TryEmplace(const Key& key, Args&&... args);
+
+    std::optional<Value> Find(const Key& key) const;
+
+    void erase(const Key& key);
+
+    // Calls function(key, value) for every element, holding the bucket of the element locked for reading
+    template <typename Function>
+    void ForEach(Function function) const;
+
+    // Same, the buckets are visited in parallel, so function may run in several threads at once
+    template <typename Function>
+    void ForEach(const std::execution::parallel_policy& policy, Function function) const;
+
+    // Buckets are copied and sorted in parallel, then merged; the map is built in key order without searching
+    std::map<Key, Value> BuildOrdinaryMap() const;
+
+private:
+    std::vector<Bucket> buckets_;
+
+    static size_t RoundUpToPowerOfTwo(size_t count) {
+        size_t result = 1;
+        while (result < count) {
+            result *= 2;
         }
         return result;
     }
 
-    void erase(const Key& key) {
-        auto& bucket = buckets_[static_cast<uint64_t>(key) % buckets_.size()];
-        std::lock_guard guard(bucket.mutex);
-        bucket.map.erase(key);
+    // Spreads close keys over buckets and slots: the high half of the hash picks the bucket, the low half the slot
+    static uint64_t Hash(const Key& key) {
+        uint64_t hash = static_cast<uint64_t>(key);
+        hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9;
+        hash = (hash ^ (hash >> 27)) * 0x94d049bb133111eb;
+        return hash ^ (hash >> 31);
     }
 
-private:
-    std::vector<Bucket> buckets_;
+    Bucket& GetBucket(uint64_t hash) {
+        return buckets_[(hash >> 32) & (buckets_.size() - 1)];
+    }
+
+    const Bucket& GetBucket(uint64_t hash) const {
+        return buckets_[(hash >> 32) & (buckets_.size() - 1)];
+    }
+
+    // Slot of the key, or the empty slot where it would go; the table must not be empty
+    static size_t FindSlot(const Bucket& bucket, const Key& key, uint64_t hash) {
+        const size_t mask = bucket.slots.size() - 1;
+        size_t slot = hash & mask;
+        while (bucket.slots[slot] && bucket.slots[slot]->first != key) {
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    static void Grow(Bucket& bucket);
 };
+
+template <typename Key, typename Value>
+template <typename... Args>
+typename ConcurrentMap<Key, Value>::Access ConcurrentMap<Key, Value>::TryEmplace(const Key& key, Args&&... args) {
+    const uint64_t hash = Hash(key);
+    Bucket& bucket = GetBucket(hash);
+    std::unique_lock guard(bucket.mutex);
+    if ((bucket.size + 1) * 4 > bucket.slots.size() * 3) {
+        Grow(bucket);
+    }
+    auto& slot = bucket.slots[FindSlot(bucket, key, hash)];
+    if (!slot) {
+        slot.emplace(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...));
+        ++bucket.size;
+    }
+    return { std::move(guard), slot->second };
+}
+
+template <typename Key, typename Value>
+std::optional<Value> ConcurrentMap<Key, Value>::Find(const Key& key) const {
+    const uint64_t hash = Hash(key);
+    const Bucket& bucket = GetBucket(hash);
+    std::shared_lock guard(bucket.mutex);
+    if (bucket.size == 0) {
+        return std::nullopt;
+    }
+    const auto& slot = bucket.slots[FindSlot(bucket, key, hash)];
+    if (!slot) {
+        return std::nullopt;
+    }
+    return slot->second;
+}
+
+template <typename Key, typename Value>
+void ConcurrentMap<Key, Value>::erase(const Key& key) {
+    const uint64_t hash = Hash(key);
+    Bucket& bucket = GetBucket(hash);
+    std::lock_guard guard(bucket.mutex);
+    if (bucket.size == 0) {
+        return;
+    }
+    size_t hole = FindSlot(bucket, key, hash);
+    if (!bucket.slots[hole]) {
+        return;
+    }
+    bucket.slots[hole].reset();
+    --bucket.size;
+    // Shift back the elements that follow, so that none of them is cut off from its home slot by the hole
+    const size_t mask = bucket.slots.size() - 1;
+    for (size_t slot = (hole + 1) & mask; bucket.slots[slot]; slot = (slot + 1) & mask) {
+        const size_t home = Hash(bucket.slots[slot]->first) & mask;
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+            bucket.slots[hole] = std::move(bucket.slots[slot]);
+            bucket.slots[slot].reset();
+            hole = slot;
+        }
+    }
+}
+
+template <typename Key, typename Value>
+template <typename Function>
+void ConcurrentMap<Key, Value>::ForEach(Function function) const {
+    for (const Bucket& bucket : buckets_) {
+        std::shared_lock guard(bucket.mutex);
+        for (const auto& slot : bucket.slots) {
+            if (slot) {
+                function(slot->first, slot->second);
+            }
+        }
+    }
+}
+
+template <typename Key, typename Value>
+template <typename Function>
+void ConcurrentMap<Key, Value>::ForEach(const std::execution::parallel_policy& policy, Function function) const {
+    std::for_each(policy, buckets_.begin(), buckets_.end(), [&function](const Bucket& bucket) {
+        std::shared_lock guard(bucket.mutex);
+        for (const auto& slot : bucket.slots) {
+            if (slot) {
+                function(slot->first, slot->second);
+            }
+        }
+    });
+}
+
+template <typename Key, typename Value>
+std::map<Key, Value> ConcurrentMap<Key, Value>::BuildOrdinaryMap() const {
+    std::vector<std::vector<std::pair<Key, Value>>> bucket_entries(buckets_.size());
+    std::vector<size_t> bucket_indexes(buckets_.size());
+    std::iota(bucket_indexes.begin(), bucket_indexes.end(), 0);
+    std::for_each(std::execution::par, bucket_indexes.begin(), bucket_indexes.end(), [this, &bucket_entries](size_t i) {
+        auto& entries = bucket_entries[i];
+        {
+            std::shared_lock guard(buckets_[i].mutex);
+            entries.reserve(buckets_[i].size);
+            for (const auto& slot : buckets_[i].slots) {
+                if (slot) {
+                    entries.push_back(*slot);
+                }
+            }
+        }
+        std::sort(entries.begin(), entries.end(), [](const auto& lhs, const auto& rhs) {
+            return lhs.first < rhs.first;
+        });
+    });
+
+    // the smallest key not yet taken from every bucket, with the bucket and the position in it
+    using Head = std::tuple<Key, size_t, size_t>;
+    std::priority_queue<Head, std::vector<Head>, std::greater<>> heads;
+    for (size_t i = 0; i < bucket_entries.size(); ++i) {
+        if (!bucket_entries[i].empty()) {
+            heads.emplace(bucket_entries[i].front().first, i, 0);
+        }
+    }
+    std::map<Key, Value> result;
+    while (!heads.empty()) {
+        const auto [key, bucket_index, position] = heads.top();
+        heads.pop();
+        auto& entries = bucket_entries[bucket_index];
+        result.emplace_hint(result.end(), key, std::move(entries[position].second));
+        if (position + 1 < entries.size()) {
+            heads.emplace(entries[position + 1].first, bucket_index, position + 1);
+        }
+    }
+    return result;
+}
+
+template <typename Key, typename Value>
+void ConcurrentMap<Key, Value>::Grow(Bucket& bucket) {
+    std::vector<std::optional<std::pair<Key, Value>>> old_slots(std::max<size_t>(8, bucket.slots.size() * 2));
+    std::swap(bucket.slots, old_slots);
+    for (auto& slot : old_slots) {
+        if (slot) {
+            const uint64_t hash = Hash(slot->first);
+            bucket.slots[FindSlot(bucket, slot->first, hash)] = std::move(slot);
+        }
+    }
+}
@@ -0,0 +1,65 @@
+#include "concurrent_search_server.h"
+#include <thread>
+
+std::vector<Document> ConcurrentSearchServer::FindTopDocuments(std::string_view raw_query) const {
+    return Read([raw_query](const SearchServer& server) {
+        return server.FindTopDocuments(raw_query);
+    });
+}
+
+std::vector<Document> ConcurrentSearchServer::FindTopDocuments(std::string_view raw_query, DocumentStatus status) const {
+    return Read([raw_query, status](const SearchServer& server) {
+        return server.FindTopDocuments(raw_query, status);
+    });
+}
+
+int ConcurrentSearchServer::GetDocumentCount() const {
+    return Read([](const SearchServer& server) {
+        return server.GetDocumentCount();
+    });
+}
+
+void ConcurrentSearchServer::AddDocument(int document_id, std::string_view document, DocumentStatus status,
+    const std::vector<int>& ratings) {
+    Write([&](SearchServer& server) {
+        server.AddDocument(document_id, document, status, ratings);
+    });
+}
+
+void ConcurrentSearchServer::AddDocuments(const std::vector<NewDocument>& documents) {
+    Write([&documents](SearchServer& server) {
+        server.AddDocuments(documents);
+    });
+}
+
+void ConcurrentSearchServer::RemoveDocument(int document_id) {
+    Write([document_id](SearchServer& server) {
+        server.RemoveDocument(document_id);
+    });
+}
+
+void ConcurrentSearchServer::RemoveDocuments(const std::vector<int>& document_ids) {
+    Write([&document_ids](SearchServer& server) {
+        server.RemoveDocuments(document_ids);
+    });
+}
+
+void ConcurrentSearchServer::CompactIndex() {
+    Write([](SearchServer& server) {
+        server.CompactIndex();
+    });
+}
+
+size_t ConcurrentSearchServer::GetReaderSlot() {
+    static std::atomic<size_t> next_slot{ 0 };
+    thread_local const size_t slot = next_slot.fetch_add(1, std::memory_order_relaxed) % READER_SLOT_COUNT;
+    return slot;
+}
+
+void ConcurrentSearchServer::WaitForReaders(int epoch) const {
+    for (const ReaderCount& reader_count : reader_counts_[epoch]) {
+        while (reader_count.count.load() != 0) {
+            std::this_thread::yield();
+        }
+    }
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <string_view>
+#include <vector>
+#include "document.h"
+#include "search_server.h"
+
+// Search server that answers queries while documents are being added and removed.
+// It keeps two copies of the index: readers use the published one, a writer changes the other,
+// publishes it and, once the readers of the old copy have left, makes the same change there.
+// Readers are counted per epoch and never wait; writers wait for each other and for the readers of the old copy
+class ConcurrentSearchServer {
+public:
+    template <typename StopWords>
+    explicit ConcurrentSearchServer(const StopWords& stop_words);
+
+    ConcurrentSearchServer(const ConcurrentSearchServer&) = delete;
+    ConcurrentSearchServer& operator=(const ConcurrentSearchServer&) = delete;
+
+    // Calls reader(const SearchServer&) on the published copy and returns its result.
+    // Views into the server, such as the words returned by MatchDocument, are valid only inside reader
+    template <typename Reader>
+    auto Read(Reader&& reader) const;
+
+    // Calls writer(SearchServer&) on both copies; readers see the change all at once.
+    // writer must make the same change both times. If the first call throws, nothing is changed
+    template <typename Writer>
+    void Write(Writer&& writer);
+
+    std::vector<Document> FindTopDocuments(std::string_view raw_query) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status) const;
+
+    int GetDocumentCount() const;
+
+    void AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+    void AddDocuments(const std::vector<NewDocument>& documents);
+    void RemoveDocument(int document_id);
+    void RemoveDocuments(const std::vector<int>& document_ids);
+    void CompactIndex();
+
+private:
+    // readers of an epoch are spread over counters of their own cache lines
+    static constexpr size_t READER_SLOT_COUNT = 16;
+
+    struct alignas(64) ReaderCount {
+        std::atomic<int> count{ 0 };
+    };
+
+    class ReaderGuard {
+    public:
+        explicit ReaderGuard(ReaderCount& reader_count) : reader_count_(reader_count) {
+            reader_count_.count.fetch_add(1);
+        }
+
+        ~ReaderGuard() {
+            reader_count_.count.fetch_sub(1, std::memory_order_release);
+        }
+
+        ReaderGuard(const ReaderGuard&) = delete;
+        ReaderGuard& operator=(const ReaderGuard&) = delete;
+
+    private:
+        ReaderCount& reader_count_;
+    };
+
+    std::array<SearchServer, 2> servers_;
+    // index of the copy the readers use
+    std::atomic<int> published_{ 0 };
+    // index of the counters new readers register in
+    std::atomic<int> epoch_{ 0 };
+    mutable std::array<std::array<ReaderCount, READER_SLOT_COUNT>, 2> reader_counts_;
+    std::mutex writer_mutex_;
+
+    // Same slot for all the reads of a thread
+    static size_t GetReaderSlot();
+
+    void WaitForReaders(int epoch) const;
+};
+
+template <typename StopWords>
+ConcurrentSearchServer::ConcurrentSearchServer(const StopWords& stop_words) :
+    servers_{ SearchServer(stop_words), SearchServer(stop_words) } {
+}
+
+template <typename Reader>
+auto ConcurrentSearchServer::Read(Reader&& reader) const {
+    // The counter is raised before the copy is chosen: a writer that has switched the epoch
+    // and seen the counters of the old one drop to zero knows no reader is left on the old copy
+    const ReaderGuard guard(reader_counts_[epoch_.load()][GetReaderSlot()]);
+    return reader(servers_[published_.load()]);
+}
+
+template <typename Writer>
+void ConcurrentSearchServer::Write(Writer&& writer) {
+    const std::lock_guard lock(writer_mutex_);
+    const int published = published_.load();
+    writer(servers_[1 - published]);
+    published_.store(1 - published);
+
+    // Readers that came before the switch may still be on the old copy; they registered
+    // in one of the two epochs, so wait for the next one to drain, move on to it and wait for the previous one
+    const int epoch = epoch_.load();
+    WaitForReaders(1 - epoch);
+    epoch_.store(1 - epoch);
+    WaitForReaders(epoch);
+    writer(servers_[published]);
+}
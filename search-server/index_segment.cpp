@@ -0,0 +1,205 @@
+#include "index_segment.h"
+
+void IndexSegment::AddDocument(int document_id, DocumentStatus status, int rating, int word_count,
+    const SnapshotArray<TermFreq>& term_freqs) {
+    const int ordinal = static_cast<int>(ordinal_to_document_id_.size());
+    for (const auto& [term_id, term_freq] : term_freqs) {
+        const auto term_count = static_cast<uint32_t>(std::max<long>(1, std::lround(term_freq * word_count)));
+        term_postings_[term_id].Add(ordinal, term_count, term_freq);
+    }
+    document_ordinals_.emplace(document_id, ordinal);
+    ordinal_to_document_id_.Mutable().push_back(document_id);
+    document_ratings_.Mutable().push_back(rating);
+    document_statuses_.Mutable().push_back(status);
+    document_word_counts_.Mutable().push_back(word_count);
+    document_inverse_word_counts_.Mutable().push_back(1.0 / word_count);
+}
+
+void IndexSegment::Append(const IndexSegment& other) {
+    std::vector<int> new_ordinals(other.ordinal_to_document_id_.size(), NO_DOCUMENT);
+    for (size_t ordinal = 0; ordinal < other.ordinal_to_document_id_.size(); ++ordinal) {
+        const int document_id = other.ordinal_to_document_id_[ordinal];
+        if (document_id == NO_DOCUMENT) {
+            continue;
+        }
+        new_ordinals[ordinal] = static_cast<int>(ordinal_to_document_id_.size());
+        document_ordinals_.emplace(document_id, new_ordinals[ordinal]);
+        ordinal_to_document_id_.Mutable().push_back(document_id);
+        document_ratings_.Mutable().push_back(other.document_ratings_[ordinal]);
+        document_statuses_.Mutable().push_back(other.document_statuses_[ordinal]);
+        document_word_counts_.Mutable().push_back(other.document_word_counts_[ordinal]);
+        document_inverse_word_counts_.Mutable().push_back(other.document_inverse_word_counts_[ordinal]);
+    }
+    // the new ordinals are past the stored ones, so every posting is appended to the tail of its list
+    for (const auto& [term_id, postings] : other.term_postings_) {
+        PostingList* target = nullptr;
+        postings.ForEach([&](int ordinal, uint32_t term_count) {
+            if (new_ordinals[ordinal] == NO_DOCUMENT) {
+                return;
+            }
+            if (target == nullptr) {
+                target = &term_postings_[term_id];
+            }
+            target->Add(new_ordinals[ordinal], term_count, other.GetTermFreq(ordinal, term_count));
+        });
+    }
+}
+
+void IndexSegment::Seal() {
+    for (auto& [term_id, postings] : term_postings_) {
+        postings.Seal();
+    }
+}
+
+int IndexSegment::GetOrdinal(int document_id) const {
+    return document_ordinals_.at(document_id);
+}
+
+int IndexSegment::GetDocumentCount() const {
+    return static_cast<int>(document_ordinals_.size());
+}
+
+size_t IndexSegment::GetPostingCount() const {
+    size_t posting_count = 0;
+    for (const auto& [term_id, postings] : term_postings_) {
+        posting_count += postings.size();
+    }
+    return posting_count;
+}
+
+size_t IndexSegment::GetPostingByteSize() const {
+    size_t byte_size = 0;
+    for (const auto& [term_id, postings] : term_postings_) {
+        byte_size += postings.GetByteSize();
+    }
+    return byte_size;
+}
+
+void IndexSegment::Save(SnapshotWriter& writer) const {
+    writer.WriteArray(ordinal_to_document_id_);
+    writer.WriteArray(document_ratings_);
+    writer.WriteArray(document_statuses_);
+    writer.WriteArray(document_word_counts_);
+    writer.WriteArray(document_inverse_word_counts_);
+    writer.Write(removed_ordinal_count_);
+    writer.Write<uint64_t>(term_postings_.size());
+    for (const auto& [term_id, postings] : term_postings_) {
+        writer.Write(term_id);
+        postings.Save(writer);
+    }
+}
+
+void IndexSegment::Load(SnapshotReader& reader) {
+    reader.ReadArray(ordinal_to_document_id_);
+    reader.ReadArray(document_ratings_);
+    reader.ReadArray(document_statuses_);
+    reader.ReadArray(document_word_counts_);
+    reader.ReadArray(document_inverse_word_counts_);
+    removed_ordinal_count_ = reader.Read<int>();
+    const size_t ordinal_count = ordinal_to_document_id_.size();
+    if (ordinal_count > static_cast<size_t>(std::numeric_limits<int>::max()) || document_ratings_.size() != ordinal_count
+        || document_statuses_.size() != ordinal_count || document_word_counts_.size() != ordinal_count
+        || document_inverse_word_counts_.size() != ordinal_count) {
+        SnapshotReader::ThrowCorrupted();
+    }
+    if (std::any_of(document_statuses_.begin(), document_statuses_.end(), [](DocumentStatus status) {
+        return static_cast<int>(status) < static_cast<int>(DocumentStatus::ACTUAL)
+            || static_cast<int>(status) > static_cast<int>(DocumentStatus::REMOVED);
+    })) {
+        SnapshotReader::ThrowCorrupted();
+    }
+    document_ordinals_.clear();
+    document_ordinals_.reserve(ordinal_count);
+    for (size_t ordinal = 0; ordinal < ordinal_count; ++ordinal) {
+        const int document_id = ordinal_to_document_id_[ordinal];
+        if (document_id != NO_DOCUMENT
+            && (document_id < 0 || !document_ordinals_.emplace(document_id, static_cast<int>(ordinal)).second)) {
+            SnapshotReader::ThrowCorrupted();
+        }
+    }
+    if (removed_ordinal_count_ != static_cast<int>(ordinal_count - document_ordinals_.size())) {
+        SnapshotReader::ThrowCorrupted();
+    }
+    term_postings_.clear();
+    // a term takes at least its id and the sizes of its list and arrays
+    const size_t term_count = reader.ReadSize(sizeof(uint32_t) + 6 * sizeof(uint64_t));
+    term_postings_.reserve(term_count);
+    for (size_t i = 0; i < term_count; ++i) {
+        const auto term_id = reader.Read<uint32_t>();
+        PostingList& postings = term_postings_[term_id];
+        if (!postings.empty()) {
+            SnapshotReader::ThrowCorrupted();
+        }
+        postings.Load(reader, static_cast<int>(ordinal_count));
+    }
+}
+
+IndexSegment::SearchScratch& IndexSegment::SearchScratch::Acquire(size_t ordinal_count) {
+    thread_local SearchScratch scratch;
+    if (scratch.relevance.size() < ordinal_count) {
+        scratch.relevance.resize(ordinal_count, 0.0);
+        scratch.marks.resize(ordinal_count, 0);
+    }
+    return scratch;
+}
+
+void IndexSegment::SearchScratch::Release() {
+    for (const int ordinal : marked_ordinals) {
+        relevance[ordinal] = 0.0;
+        marks[ordinal] = 0;
+    }
+    marked_ordinals.clear();
+}
+
+const PostingList* IndexSegment::FindPostings(uint32_t term_id) const {
+    const auto iter = term_postings_.find(term_id);
+    if (iter == term_postings_.end()) {
+        return nullptr;
+    }
+    return &iter->second;
+}
+
+void IndexSegment::RemoveDocument(int document_id) {
+    ordinal_to_document_id_.Mutable()[GetOrdinal(document_id)] = NO_DOCUMENT;
+    document_ordinals_.erase(document_id);
+    ++removed_ordinal_count_;
+}
+
+void IndexSegment::Compact() {
+    std::vector<int>& ordinal_to_document_ids = ordinal_to_document_id_.Mutable();
+    std::vector<int>& ratings = document_ratings_.Mutable();
+    std::vector<DocumentStatus>& statuses = document_statuses_.Mutable();
+    std::vector<int>& word_counts = document_word_counts_.Mutable();
+    std::vector<double>& inverse_word_counts = document_inverse_word_counts_.Mutable();
+    std::vector<int> new_ordinals(ordinal_to_document_ids.size(), NO_DOCUMENT);
+    int live_count = 0;
+    for (size_t ordinal = 0; ordinal < ordinal_to_document_ids.size(); ++ordinal) {
+        const int document_id = ordinal_to_document_ids[ordinal];
+        if (document_id == NO_DOCUMENT) {
+            continue;
+        }
+        ordinal_to_document_ids[live_count] = document_id;
+        ratings[live_count] = ratings[ordinal];
+        statuses[live_count] = statuses[ordinal];
+        word_counts[live_count] = word_counts[ordinal];
+        inverse_word_counts[live_count] = inverse_word_counts[ordinal];
+        document_ordinals_[document_id] = live_count;
+        new_ordinals[ordinal] = live_count++;
+    }
+    ordinal_to_document_ids.resize(live_count);
+    ratings.resize(live_count);
+    statuses.resize(live_count);
+    word_counts.resize(live_count);
+    inverse_word_counts.resize(live_count);
+    removed_ordinal_count_ = 0;
+    // NO_DOCUMENT is negative, so the postings of the dead ordinals are dropped
+    for (auto iter = term_postings_.begin(); iter != term_postings_.end();) {
+        iter->second.Renumber(new_ordinals);
+        if (iter->second.empty()) {
+            iter = term_postings_.erase(iter);
+        }
+        else {
+            ++iter;
+        }
+    }
+}
@@ -0,0 +1,409 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
+#include "document.h"
+#include "posting_list.h"
+#include "query_profiler.h"
+#include "top_documents.h"
+#include "snapshot.h"
+#include "term_dictionary.h"
+
+// Inverted index over a part of the documents of a shard.
+// Inside a segment documents are numbered by dense ordinals: posting lists store ordinals,
+// and the id, status and rating of a document are kept in columns indexed by ordinal.
+// A removed document leaves a tombstone: its ordinal is marked dead and skipped by the queries,
+// while its postings stay in the lists until Compact purges them all at once
+class IndexSegment {
+public:
+    // A query word together with its IDF, which comes from the statistics of the whole server
+    struct QueryTerm {
+        uint32_t term_id;
+        double inverse_document_freq;
+    };
+
+    // word_count is the number of words in the document, term frequencies are multiples of its inverse
+    void AddDocument(int document_id, DocumentStatus status, int rating, int word_count,
+        const SnapshotArray<TermFreq>& term_freqs);
+
+    // Only marks the ordinal of the document dead, the posting lists are left as they are.
+    // Throws std::out_of_range if the segment has no such document
+    void RemoveDocument(int document_id);
+
+    // Whether dead ordinals make up more than half of the segment
+    bool NeedsCompaction() const {
+        return removed_ordinal_count_ * 2 > static_cast<int>(ordinal_to_document_id_.size());
+    }
+
+    int GetRemovedDocumentCount() const {
+        return removed_ordinal_count_;
+    }
+
+    // Drops the postings of the removed documents and renumbers the rest to 0..n-1
+    void Compact();
+
+    // Appends the live documents of other after the documents of this segment, in the same order
+    void Append(const IndexSegment& other);
+
+    // Packs the incomplete last blocks of the posting lists, once no more documents are going to be added
+    void Seal();
+
+    // Throws std::out_of_range if the segment has no such document
+    int GetOrdinal(int document_id) const;
+
+    int GetDocumentCount() const;
+
+    bool HasDocument(int document_id) const {
+        return document_ordinals_.count(document_id) > 0;
+    }
+
+    int GetDocumentId(int ordinal) const {
+        return ordinal_to_document_id_[ordinal];
+    }
+
+    DocumentStatus GetStatus(int ordinal) const {
+        return document_statuses_[ordinal];
+    }
+
+    int GetRating(int ordinal) const {
+        return document_ratings_[ordinal];
+    }
+
+    int GetWordCount(int ordinal) const {
+        return document_word_counts_[ordinal];
+    }
+
+    size_t GetPostingCount() const;
+
+    size_t GetPostingByteSize() const;
+
+    // Load rebuilds the document and term lookups, the columns and postings are read in place.
+    // Throws std::runtime_error if they do not fit together
+    void Save(SnapshotWriter& writer) const;
+    void Load(SnapshotReader& reader);
+
+    // Scores every posting of every plus word. Both searches add the work they do to stats
+    template <typename DocumentPredicate>
+    void FindDocuments(const std::vector<QueryTerm>& plus_terms, const std::vector<uint32_t>& minus_terms,
+        DocumentPredicate document_predicate, TopDocuments& top_documents, QueryStats& stats) const;
+
+    // Same documents as FindDocuments, but skips the postings that cannot lift a document into top_documents:
+    // the lists and blocks whose upper bounds cannot beat the worst document of the result
+    template <typename DocumentPredicate>
+    void FindDocumentsMaxScore(const std::vector<QueryTerm>& plus_terms, const std::vector<uint32_t>& minus_terms,
+        DocumentPredicate document_predicate, TopDocuments& top_documents, QueryStats& stats) const;
+
+private:
+    // marks the ordinal of a removed document
+    static constexpr int NO_DOCUMENT = -1;
+
+    std::unordered_map<uint32_t, PostingList> term_postings_;
+    std::unordered_map<int, int> document_ordinals_;
+    // the columns of a loaded segment stay in the snapshot until it changes
+    SnapshotArray<int> ordinal_to_document_id_;
+    SnapshotArray<int> document_ratings_;
+    SnapshotArray<DocumentStatus> document_statuses_;
+    SnapshotArray<int> document_word_counts_;
+    SnapshotArray<double> document_inverse_word_counts_;
+    int removed_ordinal_count_ = 0;
+
+    // A plus word of FindDocumentsMaxScore with the most it can add to a document
+    struct BoundedTerm {
+        const PostingList* postings;
+        double inverse_document_freq;
+        double max_relevance;
+    };
+
+    // Buffers of the searches, one set per thread shared by all the segments. relevance and marks are indexed
+    // by ordinal; FindDocuments marks the matched ordinals, FindDocumentsMaxScore keeps their states there.
+    // Between searches every entry is zero and marked_ordinals is empty, the other buffers only keep their memory
+    struct SearchScratch {
+        std::vector<double> relevance;
+        std::vector<char> marks;
+        std::vector<int> marked_ordinals;
+        std::vector<BoundedTerm> terms;
+        std::vector<double> remaining_bounds;
+        std::vector<double> best_relevance;
+        std::vector<int> candidates;
+
+        // The buffers of the calling thread, grown to ordinal_count
+        static SearchScratch& Acquire(size_t ordinal_count);
+
+        // Zeroes the entries of the marked ordinals
+        void Release();
+    };
+
+    const PostingList* FindPostings(uint32_t term_id) const;
+
+    template <typename DocumentPredicate>
+    void FindDocuments(const std::vector<QueryTerm>& plus_terms, const std::vector<uint32_t>& minus_terms,
+        DocumentPredicate document_predicate, TopDocuments& top_documents, QueryStats& stats, SearchScratch& scratch) const;
+
+    template <typename DocumentPredicate>
+    void FindDocumentsMaxScore(const std::vector<QueryTerm>& plus_terms, const std::vector<uint32_t>& minus_terms,
+        DocumentPredicate document_predicate, TopDocuments& top_documents, QueryStats& stats, SearchScratch& scratch) const;
+
+    double GetTermFreq(int ordinal, uint32_t term_count) const {
+        return term_count * document_inverse_word_counts_[ordinal];
+    }
+
+    bool IsLive(int ordinal) const {
+        return ordinal_to_document_id_[ordinal] != NO_DOCUMENT;
+    }
+};
+
+template <typename DocumentPredicate>
+void IndexSegment::FindDocuments(const std::vector<QueryTerm>& plus_terms, const std::vector<uint32_t>& minus_terms,
+    DocumentPredicate document_predicate, TopDocuments& top_documents, QueryStats& stats) const {
+    // most of the small segments have none of the words of a narrow query, leave them before allocating anything
+    if (std::none_of(plus_terms.begin(), plus_terms.end(), [this](const QueryTerm& term) {
+        return FindPostings(term.term_id) != nullptr;
+    })) {
+        return;
+    }
+    SearchScratch& scratch = SearchScratch::Acquire(ordinal_to_document_id_.size());
+    try {
+        FindDocuments(plus_terms, minus_terms, document_predicate, top_documents, stats, scratch);
+    }
+    catch (...) {
+        scratch.Release();
+        throw;
+    }
+    scratch.Release();
+}
+
+template <typename DocumentPredicate>
+void IndexSegment::FindDocuments(const std::vector<QueryTerm>& plus_terms, const std::vector<uint32_t>& minus_terms,
+    DocumentPredicate document_predicate, TopDocuments& top_documents, QueryStats& stats, SearchScratch& scratch) const {
+    std::vector<double>& document_to_relevance = scratch.relevance;
+    std::vector<char>& is_matched = scratch.marks;
+    std::vector<int>& matched_ordinals = scratch.marked_ordinals;
+    for (const auto& term : plus_terms) {
+        const PostingList* postings = FindPostings(term.term_id);
+        if (postings == nullptr) {
+            continue;
+        }
+        stats.postings_scanned += postings->size();
+        postings->ForEach([&](int ordinal, uint32_t term_count) {
+            if (IsLive(ordinal)
+                && document_predicate(ordinal_to_document_id_[ordinal], document_statuses_[ordinal], document_ratings_[ordinal])) {
+                if (!is_matched[ordinal]) {
+                    is_matched[ordinal] = true;
+                    matched_ordinals.push_back(ordinal);
+                }
+                document_to_relevance[ordinal] += GetTermFreq(ordinal, term_count) * term.inverse_document_freq;
+            }
+        });
+    }
+
+    for (const uint32_t term_id : minus_terms) {
+        const PostingList* postings = FindPostings(term_id);
+        if (postings == nullptr) {
+            continue;
+        }
+        stats.postings_scanned += postings->size();
+        postings->ForEach([&is_matched](int ordinal, uint32_t) {
+            is_matched[ordinal] = false;
+        });
+    }
+
+    stats.documents_scored += matched_ordinals.size();
+    for (const int ordinal : matched_ordinals) {
+        if (is_matched[ordinal]) {
+            top_documents.Add({ ordinal_to_document_id_[ordinal], document_to_relevance[ordinal], document_ratings_[ordinal] });
+            ++stats.candidates_sorted;
+        }
+        else {
+            ++stats.minus_eliminations;
+        }
+    }
+}
+
+template <typename DocumentPredicate>
+void IndexSegment::FindDocumentsMaxScore(const std::vector<QueryTerm>& plus_terms, const std::vector<uint32_t>& minus_terms,
+    DocumentPredicate document_predicate, TopDocuments& top_documents, QueryStats& stats) const {
+    if (top_documents.GetMaxCount() == 0 || std::none_of(plus_terms.begin(), plus_terms.end(), [this](const QueryTerm& term) {
+        return FindPostings(term.term_id) != nullptr;
+    })) {
+        return;
+    }
+    SearchScratch& scratch = SearchScratch::Acquire(ordinal_to_document_id_.size());
+    try {
+        FindDocumentsMaxScore(plus_terms, minus_terms, document_predicate, top_documents, stats, scratch);
+    }
+    catch (...) {
+        scratch.Release();
+        throw;
+    }
+    scratch.Release();
+}
+
+template <typename DocumentPredicate>
+void IndexSegment::FindDocumentsMaxScore(const std::vector<QueryTerm>& plus_terms, const std::vector<uint32_t>& minus_terms,
+    DocumentPredicate document_predicate, TopDocuments& top_documents, QueryStats& stats, SearchScratch& scratch) const {
+    // The mark of an ordinal is its state; every marked ordinal is in marked_ordinals, so Release clears it.
+    // EXCLUDED documents have a minus word and have not yet been met in the lists of the plus words
+    enum : char { UNSEEN, CANDIDATE, REJECTED, EXCLUDED };
+    std::vector<char>& states = scratch.marks;
+    std::vector<double>& partial_relevance = scratch.relevance;
+    std::vector<int>& marked_ordinals = scratch.marked_ordinals;
+
+    // Terms go in query order, so a partial relevance is summed the way FindDocuments sums it and the documents
+    // that make it through need no second pass; remaining_bounds[i] is the most the terms from i-th on can add
+    std::vector<BoundedTerm>& terms = scratch.terms;
+    terms.clear();
+    for (const auto& term : plus_terms) {
+        const PostingList* postings = FindPostings(term.term_id);
+        if (postings != nullptr) {
+            terms.push_back({ postings, term.inverse_document_freq, postings->GetMaxTermFreq() * term.inverse_document_freq });
+        }
+    }
+    std::vector<double>& remaining_bounds = scratch.remaining_bounds;
+    remaining_bounds.assign(terms.size() + 1, 0.0);
+    for (size_t i = terms.size(); i > 0; --i) {
+        remaining_bounds[i - 1] = remaining_bounds[i] + terms[i - 1].max_relevance;
+    }
+
+    for (const uint32_t term_id : minus_terms) {
+        const PostingList* postings = FindPostings(term_id);
+        if (postings != nullptr) {
+            stats.postings_scanned += postings->size();
+            postings->ForEach([&](int ordinal, uint32_t) {
+                if (states[ordinal] == UNSEEN) {
+                    states[ordinal] = EXCLUDED;
+                    marked_ordinals.push_back(ordinal);
+                }
+            });
+        }
+    }
+
+    // Partial relevance only grows, so the max_count-th best partial relevance bounds the final
+    // worst result from below. A document within EPSILON of the worst one can still win on rating,
+    // the second EPSILON covers the rounding of the sums of the bounds.
+    // Documents already collected from other segments and shards raise the threshold from the start
+    const size_t max_count = top_documents.GetMaxCount();
+    const double initial_threshold = top_documents.IsFull()
+        ? top_documents.GetWorst().relevance - 2 * EPSILON
+        : -std::numeric_limits<double>::infinity();
+    size_t candidate_count = 0;
+    // once no new document can get in, the candidates left are listed apart and only they are looked through
+    std::vector<int>& candidates = scratch.candidates;
+    candidates.clear();
+    bool is_candidate_listed = false;
+    const auto compute_threshold = [&]() {
+        if (candidate_count < max_count) {
+            return initial_threshold;
+        }
+        std::vector<double>& best_relevance = scratch.best_relevance;
+        best_relevance.clear();
+        for (const int ordinal : is_candidate_listed ? candidates : marked_ordinals) {
+            if (states[ordinal] == CANDIDATE) {
+                best_relevance.push_back(partial_relevance[ordinal]);
+            }
+        }
+        std::nth_element(best_relevance.begin(), best_relevance.begin() + (max_count - 1), best_relevance.end(), std::greater<>());
+        return std::max(initial_threshold, best_relevance[max_count - 1] - 2 * EPSILON);
+    };
+
+    // A document first met in a block whose bound, with the bounds of the terms left, does not exceed
+    // the threshold cannot make it into the result: it is left unseen, and if a later term makes it a candidate,
+    // its relevance is still not above the threshold. A block that cannot lift any candidate above it is not decoded
+    double threshold = initial_threshold;
+    double max_partial_relevance = 0.0;
+    // a pass over the candidates costs about as much as a list, so it is only made when the bound of the terms left
+    // halves and it can drop many of them
+    double pruned_bound = std::numeric_limits<double>::infinity();
+    for (size_t term_index = 0; term_index < terms.size(); ++term_index) {
+        const BoundedTerm& term = terms[term_index];
+        const bool takes_new = remaining_bounds[term_index] > threshold;
+        if (!takes_new && remaining_bounds[term_index] <= pruned_bound / 2) {
+            pruned_bound = remaining_bounds[term_index];
+            if (!is_candidate_listed) {
+                for (const int ordinal : marked_ordinals) {
+                    if (states[ordinal] == CANDIDATE) {
+                        candidates.push_back(ordinal);
+                    }
+                }
+                is_candidate_listed = true;
+            }
+            // only the candidates that can still get above the threshold are worth adding to
+            max_partial_relevance = 0.0;
+            const auto hopeless = std::remove_if(candidates.begin(), candidates.end(), [&](int ordinal) {
+                if (partial_relevance[ordinal] + remaining_bounds[term_index] <= threshold) {
+                    states[ordinal] = REJECTED;
+                    return true;
+                }
+                max_partial_relevance = std::max(max_partial_relevance, partial_relevance[ordinal]);
+                return false;
+            });
+            candidate_count -= candidates.end() - hopeless;
+            candidates.erase(hopeless, candidates.end());
+            if (candidate_count == 0) {
+                break;
+            }
+        }
+        const double rest_bound = remaining_bounds[term_index + 1];
+        const size_t block_count = term.postings->GetBlockCount();
+        for (size_t block_index = 0; block_index < block_count; ++block_index) {
+            const double block_bound = term.postings->GetBlockMaxTermFreq(block_index) * term.inverse_document_freq;
+            const bool block_takes_new = takes_new && block_bound + rest_bound > threshold;
+            if (!block_takes_new && max_partial_relevance + block_bound + rest_bound <= threshold) {
+                continue;
+            }
+            int ordinals[PostingList::BLOCK_SIZE];
+            uint32_t term_counts[PostingList::BLOCK_SIZE];
+            const size_t count = term.postings->DecodeBlock(block_index, ordinals, term_counts);
+            stats.postings_scanned += count;
+            for (size_t i = 0; i < count; ++i) {
+                const int ordinal = ordinals[i];
+                char& state = states[ordinal];
+                if (state == UNSEEN) {
+                    if (!block_takes_new) {
+                        continue;
+                    }
+                    marked_ordinals.push_back(ordinal);
+                    if (IsLive(ordinal)
+                        && document_predicate(ordinal_to_document_id_[ordinal], document_statuses_[ordinal], document_ratings_[ordinal])) {
+                        state = CANDIDATE;
+                        ++candidate_count;
+                    }
+                    else {
+                        state = REJECTED;
+                        continue;
+                    }
+                }
+                else if (state != CANDIDATE) {
+                    if (state == EXCLUDED) {
+                        state = REJECTED;
+                        ++stats.minus_eliminations;
+                    }
+                    continue;
+                }
+                partial_relevance[ordinal] += GetTermFreq(ordinal, term_counts[i]) * term.inverse_document_freq;
+                max_partial_relevance = std::max(max_partial_relevance, partial_relevance[ordinal]);
+            }
+        }
+        // The threshold cannot exceed the best partial relevance, no need to compute it until that may stop
+        // taking new documents; once it has, it is computed again at the end
+        if (rest_bound > threshold && rest_bound <= std::max(max_partial_relevance, initial_threshold)) {
+            threshold = compute_threshold();
+        }
+    }
+
+    // A candidate above the final threshold missed no posting, the ones that did cannot get above it;
+    // only these go to top_documents
+    threshold = compute_threshold();
+    stats.documents_scored += candidate_count;
+    for (const int ordinal : is_candidate_listed ? candidates : marked_ordinals) {
+        if (states[ordinal] == CANDIDATE && partial_relevance[ordinal] > threshold) {
+            top_documents.Add({ ordinal_to_document_id_[ordinal], partial_relevance[ordinal], document_ratings_[ordinal] });
+            ++stats.candidates_sorted;
+        }
+    }
+}
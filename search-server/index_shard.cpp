@@ -0,0 +1,161 @@
+#include "index_shard.h"
+#include <stdexcept>
+#include <string>
+
+using namespace std::string_literals;
+
+void IndexShard::AddDocument(int document_id, DocumentStatus status, int rating, int word_count,
+    const SnapshotArray<TermFreq>& term_freqs) {
+    if (segments_.empty() || segment_tiers_.back() != OPEN_TIER) {
+        segments_.emplace_back();
+        segment_tiers_.push_back(OPEN_TIER);
+    }
+    segments_.back().AddDocument(document_id, status, rating, word_count, term_freqs);
+    ++document_count_;
+    if (segments_.back().GetDocumentCount() >= SEGMENT_CAPACITY) {
+        segments_.back().Seal();
+        segment_tiers_.back() = 0;
+        MergeSegments();
+    }
+}
+
+void IndexShard::RemoveDocument(int document_id) {
+    segments_[FindSegment(document_id)].RemoveDocument(document_id);
+    --document_count_;
+}
+
+void IndexShard::CompactSegments() {
+    for (size_t i = 0; i < segments_.size(); ++i) {
+        if (segments_[i].NeedsCompaction()) {
+            CompactSegment(i);
+        }
+    }
+    EraseEmptySegments();
+}
+
+void IndexShard::Compact() {
+    for (size_t i = 0; i < segments_.size(); ++i) {
+        if (segments_[i].GetRemovedDocumentCount() > 0) {
+            CompactSegment(i);
+        }
+    }
+    EraseEmptySegments();
+}
+
+int IndexShard::GetRemovedDocumentCount() const {
+    int removed_count = 0;
+    for (const IndexSegment& segment : segments_) {
+        removed_count += segment.GetRemovedDocumentCount();
+    }
+    return removed_count;
+}
+
+DocumentStatus IndexShard::GetStatus(int document_id) const {
+    const IndexSegment& segment = segments_[FindSegment(document_id)];
+    return segment.GetStatus(segment.GetOrdinal(document_id));
+}
+
+int IndexShard::GetRating(int document_id) const {
+    const IndexSegment& segment = segments_[FindSegment(document_id)];
+    return segment.GetRating(segment.GetOrdinal(document_id));
+}
+
+int IndexShard::GetWordCount(int document_id) const {
+    const IndexSegment& segment = segments_[FindSegment(document_id)];
+    return segment.GetWordCount(segment.GetOrdinal(document_id));
+}
+
+size_t IndexShard::GetPostingCount() const {
+    size_t posting_count = 0;
+    for (const IndexSegment& segment : segments_) {
+        posting_count += segment.GetPostingCount();
+    }
+    return posting_count;
+}
+
+size_t IndexShard::GetPostingByteSize() const {
+    size_t byte_size = 0;
+    for (const IndexSegment& segment : segments_) {
+        byte_size += segment.GetPostingByteSize();
+    }
+    return byte_size;
+}
+
+void IndexShard::Save(SnapshotWriter& writer) const {
+    writer.WriteArray(segment_tiers_);
+    for (const IndexSegment& segment : segments_) {
+        segment.Save(writer);
+    }
+}
+
+void IndexShard::Load(SnapshotReader& reader) {
+    reader.ReadArray(segment_tiers_);
+    // tiers do not grow from the oldest segment to the newest one, and only the newest may be open
+    for (size_t i = 0; i < segment_tiers_.size(); ++i) {
+        const int tier = segment_tiers_[i];
+        if (tier < OPEN_TIER || tier > MAX_TIER || (tier == OPEN_TIER && i + 1 != segment_tiers_.size())
+            || (i > 0 && tier > segment_tiers_[i - 1])) {
+            SnapshotReader::ThrowCorrupted();
+        }
+    }
+    // segments are added as they are read, a damaged count runs into the end of the data first
+    segments_.clear();
+    document_count_ = 0;
+    for (size_t i = 0; i < segment_tiers_.size(); ++i) {
+        IndexSegment& segment = segments_.emplace_back();
+        segment.Load(reader);
+        document_count_ += segment.GetDocumentCount();
+    }
+}
+
+size_t IndexShard::FindSegment(int document_id) const {
+    // the newest segments are the smallest, and the ones the recent documents are in
+    for (size_t i = segments_.size(); i > 0; --i) {
+        if (segments_[i - 1].HasDocument(document_id)) {
+            return i - 1;
+        }
+    }
+    throw std::out_of_range("Invalid document_id"s);
+}
+
+void IndexShard::MergeSegments() {
+    while (segments_.size() >= static_cast<size_t>(MERGE_FACTOR)) {
+        const size_t first = segments_.size() - MERGE_FACTOR;
+        const int tier = segment_tiers_.back();
+        if (segment_tiers_[first] != tier) {
+            return;
+        }
+        IndexSegment merged;
+        for (size_t i = first; i < segments_.size(); ++i) {
+            merged.Append(segments_[i]);
+        }
+        merged.Seal();
+        segments_.resize(first);
+        segment_tiers_.resize(first);
+        segments_.push_back(std::move(merged));
+        segment_tiers_.push_back(tier + 1);
+    }
+}
+
+void IndexShard::CompactSegment(size_t segment_index) {
+    segments_[segment_index].Compact();
+    // compaction leaves the last postings unpacked
+    if (segment_tiers_[segment_index] != OPEN_TIER) {
+        segments_[segment_index].Seal();
+    }
+}
+
+void IndexShard::EraseEmptySegments() {
+    size_t kept_count = 0;
+    for (size_t i = 0; i < segments_.size(); ++i) {
+        if (segments_[i].GetDocumentCount() > 0) {
+            if (kept_count != i) {
+                segments_[kept_count] = std::move(segments_[i]);
+                segment_tiers_[kept_count] = segment_tiers_[i];
+            }
+            ++kept_count;
+        }
+    }
+    segments_.resize(kept_count);
+    segment_tiers_.resize(kept_count);
+}
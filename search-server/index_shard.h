@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "document.h"
+#include "index_segment.h"
+#include "query_profiler.h"
+#include "snapshot.h"
+#include "term_dictionary.h"
+#include "top_documents.h"
+
+// Inverted index over a part of the server's documents, kept as a list of segments from the oldest to the newest.
+// New documents go to the last segment, the only open one; it is sealed once it has SEGMENT_CAPACITY documents,
+// and the posting lists of a sealed segment are packed to the last posting.
+// Sealed segments are merged by tiers: MERGE_FACTOR segments of one tier become a segment of the next tier,
+// leaving out their removed documents. So a document is copied a logarithmic number of times,
+// and the postings of a word are split between a few segments
+class IndexShard {
+public:
+    using QueryTerm = IndexSegment::QueryTerm;
+
+    static constexpr int SEGMENT_CAPACITY = 1024;
+    static constexpr int MERGE_FACTOR = 4;
+    // a segment of tier t holds up to SEGMENT_CAPACITY * MERGE_FACTOR^t documents, more than this one can not be numbered
+    static constexpr int MAX_TIER = 10;
+
+    void AddDocument(int document_id, DocumentStatus status, int rating, int word_count,
+        const SnapshotArray<TermFreq>& term_freqs);
+
+    // Leaves a tombstone in the segment of the document.
+    // Throws std::out_of_range if the shard has no such document
+    void RemoveDocument(int document_id);
+
+    // Purges the segments where removed documents make up more than half
+    void CompactSegments();
+
+    // Purges every removed document
+    void Compact();
+
+    int GetRemovedDocumentCount() const;
+
+    int GetDocumentCount() const {
+        return document_count_;
+    }
+
+    int GetSegmentCount() const {
+        return static_cast<int>(segments_.size());
+    }
+
+    // Throw std::out_of_range if the shard has no such document
+    DocumentStatus GetStatus(int document_id) const;
+    int GetRating(int document_id) const;
+    int GetWordCount(int document_id) const;
+
+    size_t GetPostingCount() const;
+
+    size_t GetPostingByteSize() const;
+
+    void Save(SnapshotWriter& writer) const;
+    void Load(SnapshotReader& reader);
+
+    // Both search the segments from the oldest, and largest, one
+    template <typename DocumentPredicate>
+    void FindDocuments(const std::vector<QueryTerm>& plus_terms, const std::vector<uint32_t>& minus_terms,
+        DocumentPredicate document_predicate, TopDocuments& top_documents, QueryStats& stats) const;
+
+    template <typename DocumentPredicate>
+    void FindDocumentsMaxScore(const std::vector<QueryTerm>& plus_terms, const std::vector<uint32_t>& minus_terms,
+        DocumentPredicate document_predicate, TopDocuments& top_documents, QueryStats& stats) const;
+
+private:
+    // tier of the open segment
+    static constexpr int OPEN_TIER = -1;
+
+    std::vector<IndexSegment> segments_;
+    // tiers do not grow from the oldest segment to the newest one
+    std::vector<int> segment_tiers_;
+    int document_count_ = 0;
+
+    // Throws std::out_of_range if the shard has no such document
+    size_t FindSegment(int document_id) const;
+
+    // Merges the newest sealed segments while MERGE_FACTOR of them share a tier
+    void MergeSegments();
+
+    // Compacts the segment, sealing it again unless it is the open one
+    void CompactSegment(size_t segment_index);
+
+    void EraseEmptySegments();
+};
+
+template <typename DocumentPredicate>
+void IndexShard::FindDocuments(const std::vector<QueryTerm>& plus_terms, const std::vector<uint32_t>& minus_terms,
+    DocumentPredicate document_predicate, TopDocuments& top_documents, QueryStats& stats) const {
+    for (const IndexSegment& segment : segments_) {
+        segment.FindDocuments(plus_terms, minus_terms, document_predicate, top_documents, stats);
+    }
+}
+
+template <typename DocumentPredicate>
+void IndexShard::FindDocumentsMaxScore(const std::vector<QueryTerm>& plus_terms, const std::vector<uint32_t>& minus_terms,
+    DocumentPredicate document_predicate, TopDocuments& top_documents, QueryStats& stats) const {
+    for (const IndexSegment& segment : segments_) {
+        segment.FindDocumentsMaxScore(plus_terms, minus_terms, document_predicate, top_documents, stats);
+    }
+}
@@ -1,10 +1,23 @@
 ﻿#include "search_server.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
 #include <iostream>
+#include <list>
+#include <mutex>
 #include <random>
+#include <shared_mutex>
 #include <string>
+#include <thread>
 #include <vector>
+#include "concurrent_map.h"
+#include "concurrent_search_server.h"
 #include "log_duration.h"
+#include "query_profiler.h"
 #include "process_queries.h"
+#include "remove_duplicates.h"
+#include "request_queue.h"
+#include "result_cache.h"
 
 using namespace std;
 
@@ -47,6 +60,66 @@ vector<string> GenerateQueries(mt19937& generator, const vector<string>& diction
     }
     return queries;
 }
+// SplitIntoWords and IsValidWord as they were before the text was scanned in blocks
+vector<string_view> SplitIntoWordsBytewise(string_view text) {
+    vector<string_view> words;
+    if (text.empty()) {
+        return words;
+    }
+    size_t j = 0;
+    for (size_t i = 0; i < text.size() - 1; ++i) {
+        if (text[i] == ' ') {
+            if (!text.substr(j, i - j).empty()) {
+                words.push_back(text.substr(j, i - j));
+                j = ++i;
+            }
+        }
+    }
+    if (!text.substr(j, text.length() - 1).empty()) {
+        words.push_back(text.substr(j, text.length() - 1));
+    }
+    return words;
+}
+bool IsValidWordBytewise(string_view word) {
+    return none_of(word.begin(), word.end(), [](char c) {
+        return c >= '\0' && c < ' ';
+    });
+}
+// Stops the run unless the block scan gives the words of the byte loop, at the same positions, and finds
+// the same control characters, on random texts of spaces, letters, control and non-ASCII bytes
+// that start at every offset of a block and cross its boundaries
+void CheckSplitIntoWords(string_view mark, mt19937& generator) {
+    static const string alphabet = "    aabz\0\t\n\x1f\x7f\x80\xd0\xff"s;
+    uniform_int_distribution<size_t> letter(0, alphabet.size() - 1);
+    uniform_int_distribution<size_t> length(0, 300);
+    for (int i = 0; i < 20'000; ++i) {
+        string buffer(64 + length(generator), ' ');
+        for (char& c : buffer) {
+            c = alphabet[letter(generator)];
+        }
+        const string_view text = string_view(buffer).substr(i % 64);
+        const auto words = SplitIntoWords(text);
+        const auto expected_words = SplitIntoWordsBytewise(text);
+        bool is_same = words.size() == expected_words.size() && HasControlCharacters(text) != IsValidWordBytewise(text);
+        for (size_t j = 0; is_same && j < words.size(); ++j) {
+            is_same = words[j].data() == expected_words[j].data() && words[j].size() == expected_words[j].size();
+        }
+        if (!is_same) {
+            cerr << mark << ": text of "s << text.size() << " bytes at offset "s << i % 64 << " differs"s << endl;
+            abort();
+        }
+    }
+    cout << mark << ": same words"s << endl;
+}
+template <typename Splitter>
+void TestSplitIntoWords(string_view mark, const vector<string>& texts, Splitter splitter) {
+    LOG_DURATION(mark);
+    size_t word_count = 0;
+    for (const string& text : texts) {
+        word_count += splitter(text);
+    }
+    cout << word_count << endl;
+}
 template <typename ExecutionPolicy>
 void Test(string_view mark, const SearchServer& search_server, const vector<string>& queries, ExecutionPolicy&& policy) {
     LOG_DURATION(mark);
@@ -58,7 +131,166 @@ void Test(string_view mark, const SearchServer& search_server, const vector<stri
     }
     cout << total_relevance << endl;
 }
+// Results of every query, to compare two ways of searching
+template <typename ExecutionPolicy, typename... Filter>
+vector<vector<Document>> FindAll(const SearchServer& search_server, const vector<string>& queries, ExecutionPolicy&& policy,
+    Filter... filter) {
+    vector<vector<Document>> results;
+    results.reserve(queries.size());
+    for (const string_view query : queries) {
+        results.push_back(search_server.FindTopDocuments(policy, query, filter...));
+    }
+    return results;
+}
+// Stops the run unless every query got the same documents in the same order, with bitwise equal relevance
+void CheckSameResults(string_view mark, const vector<vector<Document>>& expected, const vector<vector<Document>>& actual) {
+    bool is_same = expected.size() == actual.size();
+    for (size_t i = 0; is_same && i < expected.size(); ++i) {
+        is_same = expected[i].size() == actual[i].size();
+        for (size_t j = 0; is_same && j < expected[i].size(); ++j) {
+            is_same = expected[i][j].id == actual[i][j].id && expected[i][j].relevance == actual[i][j].relevance
+                && expected[i][j].rating == actual[i][j].rating;
+        }
+        if (!is_same) {
+            cerr << mark << ": results differ for query "s << i << endl;
+        }
+    }
+    if (!is_same) {
+        abort();
+    }
+    cout << mark << ": same results"s << endl;
+}
+// Stops the run unless both servers hold the same documents in the same order, with the same term ids
+// and frequencies, and match every document against the query the same way
+void CheckSameDocuments(string_view mark, const SearchServer& expected, const SearchServer& actual, string_view query) {
+    bool is_same = vector<int>(expected.begin(), expected.end()) == vector<int>(actual.begin(), actual.end());
+    for (auto it = expected.begin(); is_same && it != expected.end(); ++it) {
+        const auto& expected_terms = expected.GetTermFrequencies(*it);
+        const auto& actual_terms = actual.GetTermFrequencies(*it);
+        is_same = expected_terms.size() == actual_terms.size()
+            && expected.GetWordFrequencies(*it) == actual.GetWordFrequencies(*it)
+            && expected.MatchDocument(query, *it) == actual.MatchDocument(query, *it);
+        for (size_t i = 0; is_same && i < expected_terms.size(); ++i) {
+            is_same = expected_terms[i].term_id == actual_terms[i].term_id
+                && expected_terms[i].term_freq == actual_terms[i].term_freq;
+        }
+        if (!is_same) {
+            cerr << mark << ": document "s << *it << " differs"s << endl;
+        }
+    }
+    if (!is_same) {
+        abort();
+    }
+    cout << mark << ": same documents"s << endl;
+}
+// ProcessQueries as it was before the server got its own executor: the standard parallel algorithm
+// with every query copied into the task
+vector<vector<Document>> ProcessQueriesTransform(const SearchServer& search_server, const vector<string>& queries) {
+    vector<vector<Document>> documents_lists(queries.size());
+    transform(execution::par, queries.begin(), queries.end(), documents_lists.begin(),
+        [&search_server](const string query) {
+            return search_server.FindTopDocuments(query);
+        });
+    return documents_lists;
+}
+// RemoveDuplicates as it was before fingerprints: a set of strings per document as a map key
+void RemoveDuplicatesWordSets(SearchServer& search_server) {
+    vector<int> ids;
+    map<set<string>, int> document_to_id;
+    for (const int document_id : search_server) {
+        set<string> words;
+        for (const auto& [word, freq] : search_server.GetWordFrequencies(document_id)) {
+            words.emplace(word);
+        }
+        if (!document_to_id.emplace(words, document_id).second) {
+            ids.push_back(document_id);
+        }
+    }
+    for (const int id : ids) {
+        search_server.RemoveDocument(id);
+    }
+}
+template <typename Processor>
+void TestProcessQueries(string_view mark, const SearchServer& search_server, const vector<string>& queries, Processor processor) {
+    LOG_DURATION(mark);
+    double total_relevance = 0;
+    for (const auto& documents : processor(search_server, queries)) {
+        for (const auto& document : documents) {
+            total_relevance += document.relevance;
+        }
+    }
+    cout << total_relevance << endl;
+}
+template <typename Joiner>
+void TestProcessQueriesJoined(string_view mark, const SearchServer& search_server, const vector<string>& queries, Joiner joiner) {
+    LOG_DURATION(mark);
+    double total_relevance = 0;
+    joiner(search_server, queries, [&total_relevance](const Document& document) {
+        total_relevance += document.relevance;
+    });
+    cout << total_relevance << endl;
+}
+// reader_count threads run every query once while one more thread keeps writing; reader returns
+// whether the state it saw was consistent. Prints the percentiles of the read latency
+template <typename Reader, typename Writer>
+void TestMixedReadsAndWrites(string_view mark, const vector<string>& queries, int reader_count, Reader reader, Writer writer) {
+    atomic<int> running_readers = reader_count;
+    atomic<int> inconsistent_reads = 0;
+    int write_count = 0;
+    thread writer_thread([&]() {
+        while (running_readers.load() > 0) {
+            writer(write_count++);
+        }
+    });
+    vector<vector<double>> latencies(reader_count);
+    vector<thread> reader_threads;
+    for (int i = 0; i < reader_count; ++i) {
+        reader_threads.emplace_back([&, i]() {
+            for (const string& query : queries) {
+                const auto start = chrono::steady_clock::now();
+                if (!reader(query)) {
+                    ++inconsistent_reads;
+                }
+                latencies[i].push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+            }
+            --running_readers;
+        });
+    }
+    for (auto& reader_thread : reader_threads) {
+        reader_thread.join();
+    }
+    writer_thread.join();
+    vector<double> all_latencies;
+    for (const auto& thread_latencies : latencies) {
+        all_latencies.insert(all_latencies.end(), thread_latencies.begin(), thread_latencies.end());
+    }
+    sort(all_latencies.begin(), all_latencies.end());
+    const auto percentile = [&all_latencies](double share) {
+        return static_cast<int>(all_latencies[min(all_latencies.size() - 1, static_cast<size_t>(share * all_latencies.size()))]);
+    };
+    cout << mark << ": reads p50 "s << percentile(0.5) << " us, p99 "s << percentile(0.99) << " us, p99.9 "s
+        << percentile(0.999) << " us, max "s << static_cast<int>(all_latencies.back()) << " us; writes: "s << write_count
+        << ", inconsistent reads: "s << inconsistent_reads << endl;
+}
+// thread_count threads call add(key) a million times in total, with keys from a small range
+template <typename Add>
+void TestConcurrentCounting(string_view mark, int thread_count, Add add) {
+    LOG_DURATION(mark);
+    vector<thread> threads;
+    for (int i = 0; i < thread_count; ++i) {
+        threads.emplace_back([&add, i, thread_count]() {
+            mt19937 key_generator(i);
+            for (int j = 0; j < 1'000'000 / thread_count; ++j) {
+                add(static_cast<int>(key_generator() % 10'000));
+            }
+        });
+    }
+    for (auto& counting_thread : threads) {
+        counting_thread.join();
+    }
+}
 #define TEST(policy) Test(#policy, search_server, queries, execution::policy)
+#define TEST_QUERIES(mark, queries, policy) Test(mark " "s #policy, search_server, queries, execution::policy)
 int main() {
     mt19937 generator;
     const auto dictionary = GenerateDictionary(generator, 1000, 10);
@@ -67,7 +299,484 @@ int main() {
     for (size_t i = 0; i < documents.size(); ++i) {
         search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
     }
+    cout << "postings: "s << search_server.GetPostingCount() << ", bytes per posting: "s
+        << static_cast<double>(search_server.GetPostingByteSize()) / search_server.GetPostingCount() << endl;
     const auto queries = GenerateQueries(generator, dictionary, 10, 70); // поменяла тут 100 на 10
     TEST(seq);
     TEST(par);
+    const auto narrow_queries = GenerateQueries(generator, dictionary, 1000, 2);
+    TEST_QUERIES("broad", queries, seq);
+    TEST_QUERIES("narrow", narrow_queries, seq);
+    TEST_QUERIES("narrow", narrow_queries, par);
+    search_server.SetQueryEvaluation(QueryEvaluation::MAX_SCORE);
+    TEST_QUERIES("max score broad", queries, seq);
+    TEST_QUERIES("max score narrow", narrow_queries, seq);
+    search_server.SetQueryEvaluation(QueryEvaluation::EXHAUSTIVE);
+    // the checks draw from a generator of their own, so the benchmarks get the same input as before
+    mt19937 check_generator(4);
+    {
+        // MaxScore skips postings, but must return exactly what the exhaustive search does
+        const vector<string> minus_queries = [&] {
+            vector<string> generated_queries;
+            for (int i = 0; i < 300; ++i) {
+                generated_queries.push_back(GenerateQuery(check_generator, dictionary, 1 + i % 8, 0.3));
+            }
+            return generated_queries;
+        }();
+        const auto every_third = [](int document_id, DocumentStatus, int) {
+            return document_id % 3 == 0;
+        };
+        for (const auto& [mark, check_queries] : { pair{ "broad"s, &queries }, pair{ "narrow"s, &narrow_queries },
+            pair{ "minus"s, &minus_queries } }) {
+            search_server.SetQueryEvaluation(QueryEvaluation::EXHAUSTIVE);
+            const auto exhaustive = FindAll(search_server, *check_queries, execution::seq);
+            const auto exhaustive_filtered = FindAll(search_server, *check_queries, execution::seq, every_third);
+            search_server.SetQueryEvaluation(QueryEvaluation::MAX_SCORE);
+            CheckSameResults("max score "s + mark, exhaustive, FindAll(search_server, *check_queries, execution::seq));
+            CheckSameResults("max score "s + mark + " par"s, exhaustive, FindAll(search_server, *check_queries, execution::par));
+            CheckSameResults("max score "s + mark + " filtered"s, exhaustive_filtered,
+                FindAll(search_server, *check_queries, execution::seq, every_third));
+        }
+        search_server.SetQueryEvaluation(QueryEvaluation::EXHAUSTIVE);
+    }
+    // one shard is the unsharded index; IDF is global, so any split must return the same
+    search_server.SetShardCount(1);
+    const auto unsharded_broad = FindAll(search_server, queries, execution::seq);
+    const auto unsharded_narrow = FindAll(search_server, narrow_queries, execution::seq);
+    for (size_t shard_count : { 1, 2, 4, 8, 16, 32 }) {
+        search_server.SetShardCount(shard_count);
+        Test("broad par, shards: "s + to_string(shard_count), search_server, queries, execution::par);
+        CheckSameResults("shards: "s + to_string(shard_count) + ", broad par"s, unsharded_broad,
+            FindAll(search_server, queries, execution::par));
+        CheckSameResults("shards: "s + to_string(shard_count) + ", narrow seq"s, unsharded_narrow,
+            FindAll(search_server, narrow_queries, execution::seq));
+        CheckSameResults("shards: "s + to_string(shard_count) + ", narrow par"s, unsharded_narrow,
+            FindAll(search_server, narrow_queries, execution::par));
+    }
+    {
+        SearchServer rebuilt_server(dictionary[0]);
+        {
+            LOG_DURATION("rebuild index"s);
+            for (size_t i = 0; i < documents.size(); ++i) {
+                rebuilt_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+            }
+        }
+        vector<NewDocument> new_documents(documents.size());
+        for (size_t i = 0; i < documents.size(); ++i) {
+            new_documents[i] = { static_cast<int>(i), documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 } };
+        }
+        SearchServer batch_server(dictionary[0]);
+        {
+            LOG_DURATION("rebuild index, batch"s);
+            batch_server.AddDocuments(new_documents);
+        }
+        // the batch must build exactly what adding the documents one by one does
+        CheckSameDocuments("rebuild index, batch"s, rebuilt_server, batch_server, queries[0]);
+        CheckSameResults("rebuild index, batch, broad"s, FindAll(rebuilt_server, queries, execution::seq),
+            FindAll(batch_server, queries, execution::seq));
+        CheckSameResults("rebuild index, batch, narrow"s, FindAll(rebuilt_server, narrow_queries, execution::par),
+            FindAll(batch_server, narrow_queries, execution::par));
+        // tokenizing, interning and shard filling spread over the workers
+        for (size_t worker_count : { 1, 2, 4, 8 }) {
+            SearchServer workers_server(dictionary[0]);
+            workers_server.SetWorkerCount(worker_count);
+            {
+                LOG_DURATION("rebuild index, batch, workers: "s + to_string(worker_count));
+                workers_server.AddDocuments(new_documents);
+            }
+            CheckSameDocuments("rebuild index, batch, workers: "s + to_string(worker_count), rebuilt_server, workers_server, queries[0]);
+        }
+    }
+    {
+        // shuffled ids, every status and rating, several batches on top of single additions
+        const size_t document_count = min<size_t>(documents.size(), 2000);
+        vector<NewDocument> new_documents(document_count);
+        for (size_t i = 0; i < document_count; ++i) {
+            new_documents[i] = { static_cast<int>(i * 3), documents[i], static_cast<DocumentStatus>(i % 4),
+                { static_cast<int>(i % 7) - 3, static_cast<int>(i % 5) } };
+        }
+        shuffle(new_documents.begin(), new_documents.end(), check_generator);
+        SearchServer single_server(dictionary[0]);
+        for (const NewDocument& document : new_documents) {
+            single_server.AddDocument(document.id, document.text, document.status, document.ratings);
+        }
+        SearchServer batch_server(dictionary[0]);
+        const size_t single_count = document_count / 4;
+        for (size_t i = 0; i < single_count; ++i) {
+            batch_server.AddDocument(new_documents[i].id, new_documents[i].text, new_documents[i].status,
+                new_documents[i].ratings);
+        }
+        for (size_t begin = single_count; begin < document_count; begin += 300) {
+            batch_server.AddDocuments({ new_documents.begin() + begin,
+                new_documents.begin() + min(begin + 300, document_count) });
+        }
+        CheckSameDocuments("mixed batches"s, single_server, batch_server, narrow_queries[0]);
+        for (const DocumentStatus status : { DocumentStatus::ACTUAL, DocumentStatus::BANNED }) {
+            CheckSameResults("mixed batches, status "s + to_string(static_cast<int>(status)),
+                FindAll(single_server, narrow_queries, execution::seq, status),
+                FindAll(batch_server, narrow_queries, execution::seq, status));
+        }
+    }
+    {
+        LOG_DURATION("save snapshot"s);
+        search_server.SaveSnapshot("search_server.snapshot"s);
+    }
+    {
+        const auto load_snapshot = [] {
+            LOG_DURATION("load snapshot"s);
+            return SearchServer::LoadSnapshot("search_server.snapshot"s);
+        };
+        const SearchServer loaded_server = load_snapshot();
+        Test("broad par, loaded snapshot"s, loaded_server, queries, execution::par);
+        // the loaded server must answer exactly like the one that was saved
+        CheckSameResults("loaded snapshot, broad"s, FindAll(search_server, queries, execution::seq),
+            FindAll(loaded_server, queries, execution::seq));
+        CheckSameResults("loaded snapshot, narrow"s, FindAll(search_server, narrow_queries, execution::seq),
+            FindAll(loaded_server, narrow_queries, execution::seq));
+        CheckSameDocuments("loaded snapshot"s, search_server, loaded_server, queries[0]);
+    }
+    remove("search_server.snapshot");
+    {
+        // a few distinct queries asked over and over, and one query matched against every document
+        const auto repeated_queries = GenerateQueries(generator, dictionary, 100, 5);
+        double total_relevance = 0;
+        {
+            LOG_DURATION("repeated queries, raw"s);
+            for (int i = 0; i < 10'000; ++i) {
+                for (const auto& document : search_server.FindTopDocuments(repeated_queries[i % repeated_queries.size()])) {
+                    total_relevance += document.relevance;
+                }
+            }
+        }
+        cout << total_relevance << endl;
+        total_relevance = 0;
+        {
+            LOG_DURATION("repeated queries, prepared"s);
+            vector<PreparedQuery> prepared_queries;
+            for (const string& query : repeated_queries) {
+                prepared_queries.push_back(search_server.PrepareQuery(query));
+            }
+            for (int i = 0; i < 10'000; ++i) {
+                for (const auto& document : search_server.FindTopDocuments(prepared_queries[i % prepared_queries.size()])) {
+                    total_relevance += document.relevance;
+                }
+            }
+        }
+        cout << total_relevance << endl;
+        const string& match_query = queries[0];
+        size_t matched_word_count = 0;
+        {
+            LOG_DURATION("match document, raw"s);
+            for (const int document_id : search_server) {
+                matched_word_count += get<0>(search_server.MatchDocument(match_query, document_id)).size();
+            }
+        }
+        cout << matched_word_count << endl;
+        matched_word_count = 0;
+        {
+            LOG_DURATION("match document, raw par"s);
+            for (const int document_id : search_server) {
+                matched_word_count += get<0>(search_server.MatchDocument(execution::par, match_query, document_id)).size();
+            }
+        }
+        cout << matched_word_count << endl;
+        matched_word_count = 0;
+        {
+            LOG_DURATION("match document, prepared"s);
+            const PreparedQuery prepared_query = search_server.PrepareQuery(match_query);
+            for (const int document_id : search_server) {
+                matched_word_count += get<0>(search_server.MatchDocument(prepared_query, document_id)).size();
+            }
+        }
+        cout << matched_word_count << endl;
+        // the snippet stage: one query against a thousand candidates
+        const vector<int> candidate_ids(search_server.begin(), search_server.begin() + 1000);
+        matched_word_count = 0;
+        {
+            LOG_DURATION("match 1000 documents, one by one"s);
+            for (int i = 0; i < 10; ++i) {
+                for (const int document_id : candidate_ids) {
+                    matched_word_count += get<0>(search_server.MatchDocument(match_query, document_id)).size();
+                }
+            }
+        }
+        cout << matched_word_count << endl;
+        vector<tuple<vector<string_view>, DocumentStatus>> match_results;
+        for (const auto& [policy_name, parallel] : { pair{ "seq"s, false }, pair{ "par"s, true } }) {
+            matched_word_count = 0;
+            LOG_DURATION("match 1000 documents, batch "s + policy_name);
+            for (int i = 0; i < 10; ++i) {
+                if (parallel) {
+                    search_server.MatchDocuments(execution::par, match_query, candidate_ids, match_results);
+                }
+                else {
+                    search_server.MatchDocuments(execution::seq, match_query, candidate_ids, match_results);
+                }
+                for (const auto& [words, status] : match_results) {
+                    matched_word_count += words.size();
+                }
+            }
+            cout << matched_word_count << endl;
+        }
+    }
+    {
+        // skewed traffic: the 10 hottest of 1000 queries make 40% of the requests
+        const auto distinct_queries = GenerateQueries(generator, dictionary, 1000, 5);
+        vector<string> requests;
+        for (int i = 0; i < 5000; ++i) {
+            const bool is_hot = uniform_int_distribution(0, 9)(generator) < 4;
+            requests.push_back(distinct_queries[uniform_int_distribution<int>(0, is_hot ? 9 : 999)(generator)]);
+        }
+        {
+            LOG_DURATION("request queue, no cache"s);
+            RequestQueue request_queue(search_server);
+            for (const string& request : requests) {
+                request_queue.AddFindRequest(request);
+            }
+            cout << request_queue.GetNoResultRequests() << endl;
+        }
+        {
+            LOG_DURATION("request queue, result cache"s);
+            ResultCache result_cache(search_server, 100);
+            RequestQueue request_queue(result_cache);
+            for (const string& request : requests) {
+                request_queue.AddFindRequest(request);
+            }
+            cout << request_queue.GetNoResultRequests() << endl;
+            const auto metrics = result_cache.GetMetrics();
+            cout << "hits: "s << metrics.hit_count << ", misses: "s << metrics.miss_count
+                << ", evictions: "s << metrics.eviction_count << endl;
+        }
+    }
+    const auto batch_queries = GenerateQueries(generator, dictionary, 20'000, 2);
+    TestProcessQueries("process queries, transform", search_server, batch_queries, ProcessQueriesTransform);
+    TestProcessQueries("process queries, executor", search_server, batch_queries, ProcessQueries);
+    for (size_t worker_count : { 1, 2, 4, 8 }) {
+        search_server.SetWorkerCount(worker_count);
+        TestProcessQueries("process queries, workers: "s + to_string(worker_count), search_server, batch_queries, ProcessQueries);
+    }
+    TestProcessQueriesJoined("joined, list copy", search_server, batch_queries, [](const auto& server, const auto& queries, auto callback) {
+        list<Document> documents;
+        for (const auto& query_documents : ProcessQueries(server, queries)) {
+            documents.insert(documents.end(), query_documents.begin(), query_documents.end());
+        }
+        for_each(documents.begin(), documents.end(), callback);
+    });
+    TestProcessQueriesJoined("joined, view", search_server, batch_queries, [](const auto& server, const auto& queries, auto callback) {
+        for (const Document& document : ProcessQueriesJoined(server, queries)) {
+            callback(document);
+        }
+    });
+    TestProcessQueriesJoined("joined, streaming", search_server, batch_queries, [](const auto& server, const auto& queries, auto callback) {
+        ProcessQueriesJoined(server, queries, callback);
+    });
+    const auto print_memory_usage = [&search_server](string_view mark) {
+        const auto text = search_server.GetTextMemoryUsage();
+        const auto words = search_server.GetWordMemoryUsage();
+        cout << mark << ": documents: "s << search_server.GetDocumentCount()
+            << ", text bytes live/allocated: "s << text.live_bytes << '/' << text.allocated_bytes
+            << ", word bytes live/allocated: "s << words.live_bytes << '/' << words.allocated_bytes << endl;
+    };
+    print_memory_usage("memory before removal"s);
+    {
+        LOG_DURATION("remove 3 of 4 documents"s);
+        for (size_t i = 0; i < documents.size(); ++i) {
+            if (i % 4 != 0) {
+                search_server.RemoveDocument(i);
+            }
+        }
+    }
+    print_memory_usage("memory after removal"s);
+    {
+        // removal in random order; a single removal may have to purge a part of the index
+        SearchServer churn_server(dictionary[0]);
+        for (size_t i = 0; i < documents.size(); ++i) {
+            churn_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+        }
+        vector<int> removal_order(documents.size());
+        iota(removal_order.begin(), removal_order.end(), 0);
+        shuffle(removal_order.begin(), removal_order.end(), mt19937(17));
+        double slowest_removal = 0;
+        {
+            LOG_DURATION("remove 3 of 4 documents, random order"s);
+            for (size_t i = 0; i < removal_order.size() * 3 / 4; ++i) {
+                const auto start = chrono::steady_clock::now();
+                churn_server.RemoveDocument(removal_order[i]);
+                slowest_removal = max(slowest_removal, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+            }
+        }
+        cout << "slowest removal: "s << slowest_removal << " ms"s << endl;
+    }
+    {
+        SearchServer removal_server(dictionary[0]);
+        for (size_t i = 0; i < documents.size(); ++i) {
+            removal_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+        }
+        vector<int> removed_ids;
+        for (size_t i = 0; i < documents.size(); ++i) {
+            if (i % 4 != 0) {
+                removed_ids.push_back(i);
+            }
+        }
+        LOG_DURATION("remove 3 of 4 documents, batch"s);
+        removal_server.RemoveDocuments(removed_ids);
+    }
+    {
+        // every 1000th document repeats an earlier one with its words in reverse order
+        const auto make_server = [&documents] {
+            SearchServer server("and in"s);
+            for (size_t i = 0; i < documents.size(); ++i) {
+                string text = documents[i];
+                if (i % 1000 == 999) {
+                    const auto words = SplitIntoWords(documents[i - 500]);
+                    text.clear();
+                    for (auto word = words.rbegin(); word != words.rend(); ++word) {
+                        if (!text.empty()) {
+                            text.push_back(' ');
+                        }
+                        text += *word;
+                    }
+                }
+                server.AddDocument(i, text, DocumentStatus::ACTUAL, { 1 });
+            }
+            return server;
+        };
+        SearchServer word_sets_server = make_server();
+        {
+            LOG_DURATION("remove duplicates, word sets"s);
+            RemoveDuplicatesWordSets(word_sets_server);
+        }
+        SearchServer fingerprints_server = make_server();
+        DuplicateDetector detector;
+        {
+            LOG_DURATION("remove duplicates, fingerprints"s);
+            detector.RemoveDuplicates(fingerprints_server);
+        }
+        cout << word_sets_server.GetDocumentCount() << ' ' << fingerprints_server.GetDocumentCount() << endl;
+        fingerprints_server.AddDocument(documents.size(), documents[0], DocumentStatus::ACTUAL, { 1 });
+        {
+            LOG_DURATION("remove duplicates, incremental"s);
+            detector.RemoveDuplicates(fingerprints_server);
+        }
+    }
+    {
+        // every 100th document is an earlier one with a single word replaced
+        SearchServer near_duplicates_server("and in"s);
+        for (size_t i = 0; i < documents.size(); ++i) {
+            string text = documents[i];
+            if (i % 100 == 99) {
+                text = documents[i - 50];
+                text.replace(0, text.find(' '), dictionary[i % dictionary.size()]);
+            }
+            near_duplicates_server.AddDocument(i, text, DocumentStatus::ACTUAL, { 1 });
+        }
+        LOG_DURATION("find near duplicates"s);
+        size_t near_duplicate_count = 0;
+        for (const auto& cluster : FindNearDuplicates(near_duplicates_server)) {
+            near_duplicate_count += cluster.size() - 1;
+        }
+        cout << "near duplicates: "s << near_duplicate_count << endl;
+    }
+    {
+        // long documents, every word is checked as AddDocument does
+        const auto long_texts = GenerateQueries(generator, dictionary, 100, 20'000);
+        TestSplitIntoWords("split into words, bytewise"s, long_texts, [](string_view text) {
+            const auto words = SplitIntoWordsBytewise(text);
+            return static_cast<size_t>(count_if(words.begin(), words.end(), IsValidWordBytewise));
+        });
+        const TextScanLevel best_level = GetTextScanLevel();
+        for (const auto& [level, name] : { pair{ TextScanLevel::SCALAR, "scalar"s }, pair{ TextScanLevel::SSE2, "sse2"s },
+            pair{ TextScanLevel::AVX2, "avx2"s } }) {
+            SetTextScanLevel(level);
+            if (GetTextScanLevel() != level) {
+                continue;
+            }
+            TestSplitIntoWords("split into words, "s + name, long_texts, [](string_view text) {
+                return HasControlCharacters(text) ? 0 : SplitIntoWords(text).size();
+            });
+            CheckSplitIntoWords("split into words, "s + name, check_generator);
+        }
+        SetTextScanLevel(best_level);
+    }
+    for (const int thread_count : { 1, 4 }) {
+        ConcurrentMap<int, int> counts(64);
+        TestConcurrentCounting("concurrent map, threads: "s + to_string(thread_count), thread_count, [&counts](int key) {
+            ++counts[key].ref_to_value;
+        });
+        map<int, int> locked_counts;
+        mutex counts_mutex;
+        TestConcurrentCounting("map under one mutex, threads: "s + to_string(thread_count), thread_count, [&](int key) {
+            const lock_guard lock(counts_mutex);
+            ++locked_counts[key];
+        });
+        LOG_DURATION("concurrent map, build ordinary map"s);
+        cout << (counts.BuildOrdinaryMap() == locked_counts) << endl;
+    }
+    {
+        // Every write adds a pair of documents or removes the pair added before it,
+        // so a consistent state always has an even number of documents
+        const auto read_queries = GenerateQueries(generator, dictionary, 2'000, 10);
+        const size_t initial_count = 5'000;
+        const int first_new_id = static_cast<int>(documents.size());
+        const auto make_pair_documents = [&documents, first_new_id](int write_index) {
+            const int id = first_new_id + write_index / 2 * 2;
+            return vector<NewDocument>{ { id, documents[id % documents.size()], DocumentStatus::ACTUAL, { 1 } },
+                { id + 1, documents[(id + 1) % documents.size()], DocumentStatus::ACTUAL, { 1 } } };
+        };
+        vector<NewDocument> initial_documents;
+        for (size_t i = 0; i < initial_count; ++i) {
+            initial_documents.push_back({ static_cast<int>(i), documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 } });
+        }
+
+        SearchServer locked_server(dictionary[0]);
+        locked_server.AddDocuments(initial_documents);
+        shared_mutex server_mutex;
+        TestMixedReadsAndWrites("mixed reads and writes, shared mutex"s, read_queries, 4, [&](const string& query) {
+            const shared_lock lock(server_mutex);
+            locked_server.FindTopDocuments(query);
+            return locked_server.GetDocumentCount() % 2 == 0;
+        }, [&](int write_index) {
+            const auto pair_documents = make_pair_documents(write_index);
+            const unique_lock lock(server_mutex);
+            if (write_index % 2 == 0) {
+                locked_server.AddDocuments(pair_documents);
+            }
+            else {
+                locked_server.RemoveDocuments({ pair_documents[0].id, pair_documents[1].id });
+            }
+        });
+
+        ConcurrentSearchServer concurrent_server(dictionary[0]);
+        concurrent_server.AddDocuments(initial_documents);
+        TestMixedReadsAndWrites("mixed reads and writes, two copies"s, read_queries, 4, [&](const string& query) {
+            return concurrent_server.Read([&query](const SearchServer& server) {
+                server.FindTopDocuments(query);
+                return server.GetDocumentCount() % 2 == 0;
+            });
+        }, [&](int write_index) {
+            const auto pair_documents = make_pair_documents(write_index);
+            if (write_index % 2 == 0) {
+                concurrent_server.AddDocuments(pair_documents);
+            }
+            else {
+                concurrent_server.RemoveDocuments({ pair_documents[0].id, pair_documents[1].id });
+            }
+        });
+    }
+    {
+        // the same queries without and with a profiler attached
+        vector<string> profiled_queries;
+        for (int i = 0; i < 2'000; ++i) {
+            profiled_queries.push_back(GenerateQuery(generator, dictionary, 10, 0.1));
+        }
+        Test("queries, no profiler"s, search_server, profiled_queries, execution::seq);
+        const auto profiler = make_shared<QueryProfiler>(1);
+        search_server.SetQueryProfiler(profiler);
+        Test("queries, profiler"s, search_server, profiled_queries, execution::seq);
+        Test("queries, profiler par"s, search_server, profiled_queries, execution::par);
+        search_server.SetQueryProfiler(nullptr);
+        cout << profiler->ExportJson() << endl;
+        const string prometheus_text = profiler->ExportPrometheus();
+        cout << prometheus_text.substr(prometheus_text.rfind("# HELP"s)) << endl;
+    }
 }
\ No newline at end of file
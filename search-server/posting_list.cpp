@@ -0,0 +1,311 @@
+#include "posting_list.h"
+#include <cstring>
+
+namespace {
+
+// packed data is followed by this many zero bytes, so that any value can be read with one 8-byte load
+const size_t PACKED_PADDING = 8;
+
+int GetBitWidth(uint32_t max_value) {
+    int bits = 0;
+    while (bits < 32 && (max_value >> bits) != 0) {
+        ++bits;
+    }
+    return bits;
+}
+
+void AppendPacked(const uint32_t* values, size_t count, int bits, std::vector<uint8_t>& packed) {
+    const size_t offset = packed.size() - PACKED_PADDING;
+    packed.resize(offset + (count * bits + 7) / 8 + PACKED_PADDING, 0);
+    for (size_t i = 0; i < count; ++i) {
+        const size_t bit = i * bits;
+        uint64_t word;
+        std::memcpy(&word, &packed[offset + bit / 8], sizeof(word));
+        word |= static_cast<uint64_t>(values[i]) << (bit % 8);
+        std::memcpy(&packed[offset + bit / 8], &word, sizeof(word));
+    }
+}
+
+// A branch-free loop over fixed-width values, which the compiler is free to vectorize
+void Unpack(const uint8_t* data, size_t count, int bits, uint32_t* values) {
+    const uint64_t mask = (static_cast<uint64_t>(1) << bits) - 1;
+    for (size_t i = 0; i < count; ++i) {
+        const size_t bit = i * bits;
+        uint64_t word;
+        std::memcpy(&word, data + bit / 8, sizeof(word));
+        values[i] = static_cast<uint32_t>((word >> (bit % 8)) & mask);
+    }
+}
+
+} // namespace
+
+void PostingList::Cursor::SkipTo(int ordinal) {
+    if (IsEnd() || ordinals_[position_] >= ordinal) {
+        return;
+    }
+    if (ordinals_[size_ - 1] < ordinal) {
+        LoadBlock(postings_->FindBlock(block_index_ + 1, ordinal));
+        if (IsEnd()) {
+            return;
+        }
+    }
+    position_ = std::lower_bound(ordinals_ + position_, ordinals_ + size_, ordinal) - ordinals_;
+}
+
+void PostingList::Cursor::LoadBlock(size_t block_index) {
+    block_index_ = block_index;
+    position_ = 0;
+    size_ = block_index < postings_->GetBlockCount() ? postings_->DecodeBlock(block_index, ordinals_, term_counts_) : 0;
+}
+
+void PostingList::Add(int ordinal, uint32_t term_count, double term_freq) {
+    if (size_ == 0 || GetBlockLastOrdinal(GetBlockCount() - 1) < ordinal) {
+        max_term_freq_ = std::max(max_term_freq_, term_freq);
+        if (tail_ordinals_.empty() && size_ != blocks_.size() * BLOCK_SIZE) {
+            UnsealLastBlock();
+        }
+        tail_ordinals_.Mutable().push_back(ordinal);
+        tail_counts_.Mutable().push_back(term_count);
+        tail_max_term_freq_ = std::max(tail_max_term_freq_, term_freq);
+        ++size_;
+        if (tail_ordinals_.size() == BLOCK_SIZE) {
+            SealTail();
+        }
+        return;
+    }
+    std::vector<int> ordinals;
+    std::vector<uint32_t> term_counts;
+    std::vector<double> term_freq_bounds;
+    DecodeAll(ordinals, term_counts, term_freq_bounds);
+    const auto iter = std::lower_bound(ordinals.begin(), ordinals.end(), ordinal);
+    const auto offset = iter - ordinals.begin();
+    if (iter != ordinals.end() && *iter == ordinal) {
+        // the occurrences of one document add up, and so do their term frequencies
+        term_counts[offset] += term_count;
+        term_freq_bounds[offset] += term_freq;
+    }
+    else {
+        ordinals.insert(iter, ordinal);
+        term_counts.insert(term_counts.begin() + offset, term_count);
+        term_freq_bounds.insert(term_freq_bounds.begin() + offset, term_freq);
+    }
+    max_term_freq_ = std::max(max_term_freq_, term_freq_bounds[offset]);
+    EncodeAll(ordinals, term_counts, term_freq_bounds);
+}
+
+void PostingList::Seal() {
+    if (!tail_ordinals_.empty()) {
+        SealTail();
+    }
+    blocks_.ShrinkToFit();
+    packed_.ShrinkToFit();
+}
+
+void PostingList::Renumber(const std::vector<int>& new_ordinals) {
+    std::vector<int> ordinals;
+    std::vector<uint32_t> term_counts;
+    std::vector<double> term_freq_bounds;
+    DecodeAll(ordinals, term_counts, term_freq_bounds);
+    size_t kept_count = 0;
+    for (size_t i = 0; i < ordinals.size(); ++i) {
+        if (new_ordinals[ordinals[i]] >= 0) {
+            ordinals[kept_count] = new_ordinals[ordinals[i]];
+            term_counts[kept_count] = term_counts[i];
+            term_freq_bounds[kept_count] = term_freq_bounds[i];
+            ++kept_count;
+        }
+    }
+    ordinals.resize(kept_count);
+    term_counts.resize(kept_count);
+    term_freq_bounds.resize(kept_count);
+    EncodeAll(ordinals, term_counts, term_freq_bounds);
+}
+
+size_t PostingList::DecodeBlock(size_t block_index, int* ordinals, uint32_t* term_counts) const {
+    if (block_index == blocks_.size()) {
+        std::copy(tail_ordinals_.begin(), tail_ordinals_.end(), ordinals);
+        std::copy(tail_counts_.begin(), tail_counts_.end(), term_counts);
+        return tail_ordinals_.size();
+    }
+    const Block& block = blocks_[block_index];
+    const uint8_t* data = packed_.data() + block.offset;
+    const size_t count = GetBlockSize(block_index);
+    // gaps and counts are stored minus one, so runs of adjacent documents and single occurrences take no bits
+    uint32_t gaps[BLOCK_SIZE - 1];
+    Unpack(data, count - 1, block.gap_bits, gaps);
+    Unpack(data + ((count - 1) * block.gap_bits + 7) / 8, count, block.count_bits, term_counts);
+    ordinals[0] = block.first_ordinal;
+    for (size_t i = 1; i < count; ++i) {
+        ordinals[i] = ordinals[i - 1] + static_cast<int>(gaps[i - 1]) + 1;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        ++term_counts[i];
+    }
+    return count;
+}
+
+size_t PostingList::GetByteSize() const {
+    return blocks_.GetByteSize() + packed_.GetByteSize() + tail_ordinals_.GetByteSize() + tail_counts_.GetByteSize();
+}
+
+void PostingList::Save(SnapshotWriter& writer) const {
+    writer.Write<uint64_t>(size_);
+    writer.Write(max_term_freq_);
+    writer.Write(tail_max_term_freq_);
+    writer.WriteArray(blocks_);
+    writer.WriteArray(packed_);
+    writer.WriteArray(tail_ordinals_);
+    writer.WriteArray(tail_counts_);
+}
+
+void PostingList::Load(SnapshotReader& reader, int ordinal_count) {
+    size_ = reader.Read<uint64_t>();
+    max_term_freq_ = reader.Read<double>();
+    tail_max_term_freq_ = reader.Read<double>();
+    reader.ReadArray(blocks_);
+    reader.ReadArray(packed_);
+    reader.ReadArray(tail_ordinals_);
+    reader.ReadArray(tail_counts_);
+    // without a tail the last block may be incomplete, but not empty
+    const size_t full_block_count = tail_ordinals_.empty() && !blocks_.empty() ? blocks_.size() - 1 : blocks_.size();
+    if (tail_ordinals_.size() >= BLOCK_SIZE || tail_counts_.size() != tail_ordinals_.size()
+        || size_ < full_block_count * BLOCK_SIZE + tail_ordinals_.size() + (blocks_.size() - full_block_count)
+        || size_ > blocks_.size() * BLOCK_SIZE + tail_ordinals_.size()
+        || (!blocks_.empty() && packed_.size() < PACKED_PADDING)
+        || !(tail_max_term_freq_ >= 0.0 && tail_max_term_freq_ <= max_term_freq_)) {
+        SnapshotReader::ThrowCorrupted();
+    }
+    // ordinals are summed in 64 bits, so that no gap can overflow them
+    int64_t last_ordinal = -1;
+    for (size_t i = 0; i < blocks_.size(); ++i) {
+        const Block& block = blocks_[i];
+        const size_t count = GetBlockSize(i);
+        const size_t byte_size = ((count - 1) * block.gap_bits + 7) / 8 + (count * block.count_bits + 7) / 8;
+        if (block.gap_bits > 32 || block.count_bits > 32 || block.first_ordinal <= last_ordinal
+            || !(block.max_term_freq >= 0.0 && block.max_term_freq <= max_term_freq_)
+            || byte_size > packed_.size() - PACKED_PADDING || block.offset > packed_.size() - PACKED_PADDING - byte_size) {
+            SnapshotReader::ThrowCorrupted();
+        }
+        uint32_t gaps[BLOCK_SIZE - 1];
+        Unpack(packed_.data() + block.offset, count - 1, block.gap_bits, gaps);
+        last_ordinal = block.first_ordinal;
+        for (size_t j = 0; j + 1 < count; ++j) {
+            last_ordinal += static_cast<int64_t>(gaps[j]) + 1;
+        }
+        if (last_ordinal != block.last_ordinal || last_ordinal >= ordinal_count) {
+            SnapshotReader::ThrowCorrupted();
+        }
+    }
+    for (const int ordinal : tail_ordinals_) {
+        if (ordinal <= last_ordinal || ordinal >= ordinal_count) {
+            SnapshotReader::ThrowCorrupted();
+        }
+        last_ordinal = ordinal;
+    }
+}
+
+size_t PostingList::FindBlock(size_t first_block, int ordinal) const {
+    // a cursor on the tail asks from the block after it, past the packed blocks
+    const auto iter = std::partition_point(blocks_.begin() + std::min(first_block, blocks_.size()), blocks_.end(),
+        [ordinal](const Block& block) {
+        return block.last_ordinal < ordinal;
+    });
+    if (iter != blocks_.end()) {
+        return iter - blocks_.begin();
+    }
+    // the tail if it reaches the ordinal, otherwise past the last block
+    return !tail_ordinals_.empty() && tail_ordinals_.back() >= ordinal ? blocks_.size() : GetBlockCount();
+}
+
+size_t PostingList::GetBlockSize(size_t block_index) const {
+    if (block_index == blocks_.size()) {
+        return tail_ordinals_.size();
+    }
+    // only the last packed block can be incomplete, and only when there is no tail
+    return block_index + 1 < blocks_.size() ? BLOCK_SIZE : size_ - tail_ordinals_.size() - block_index * BLOCK_SIZE;
+}
+
+void PostingList::SealTail() {
+    const size_t count = tail_ordinals_.size();
+    uint32_t gaps[BLOCK_SIZE - 1];
+    uint32_t counts[BLOCK_SIZE];
+    uint32_t max_gap = 0;
+    uint32_t max_count = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (i > 0) {
+            gaps[i - 1] = static_cast<uint32_t>(tail_ordinals_[i] - tail_ordinals_[i - 1] - 1);
+            max_gap = std::max(max_gap, gaps[i - 1]);
+        }
+        counts[i] = tail_counts_[i] - 1;
+        max_count = std::max(max_count, counts[i]);
+    }
+    std::vector<uint8_t>& packed = packed_.Mutable();
+    if (packed.empty()) {
+        packed.resize(PACKED_PADDING, 0);
+    }
+    Block block;
+    block.max_term_freq = tail_max_term_freq_;
+    block.first_ordinal = tail_ordinals_.front();
+    block.last_ordinal = tail_ordinals_.back();
+    block.offset = static_cast<uint32_t>(packed.size() - PACKED_PADDING);
+    block.gap_bits = static_cast<uint8_t>(GetBitWidth(max_gap));
+    block.count_bits = static_cast<uint8_t>(GetBitWidth(max_count));
+    AppendPacked(gaps, count - 1, block.gap_bits, packed);
+    AppendPacked(counts, count, block.count_bits, packed);
+    blocks_.Mutable().push_back(block);
+    tail_max_term_freq_ = 0.0;
+    if (count == BLOCK_SIZE) {
+        tail_ordinals_.Mutable().clear();
+        tail_counts_.Mutable().clear();
+    }
+    else {
+        // an incomplete block is packed by Seal, the list is not expected to grow
+        tail_ordinals_ = {};
+        tail_counts_ = {};
+    }
+}
+
+void PostingList::UnsealLastBlock() {
+    int ordinals[BLOCK_SIZE];
+    uint32_t term_counts[BLOCK_SIZE];
+    const size_t count = DecodeBlock(blocks_.size() - 1, ordinals, term_counts);
+    tail_max_term_freq_ = blocks_.back().max_term_freq;
+    std::vector<uint8_t>& packed = packed_.Mutable();
+    packed.resize(blocks_.back().offset);
+    packed.resize(blocks_.back().offset + PACKED_PADDING, 0);
+    blocks_.Mutable().pop_back();
+    tail_ordinals_.Mutable().assign(ordinals, ordinals + count);
+    tail_counts_.Mutable().assign(term_counts, term_counts + count);
+}
+
+void PostingList::DecodeAll(std::vector<int>& ordinals, std::vector<uint32_t>& term_counts,
+    std::vector<double>& term_freq_bounds) const {
+    ordinals.resize(size_);
+    term_counts.resize(size_);
+    term_freq_bounds.resize(size_);
+    size_t position = 0;
+    for (size_t i = 0; i < GetBlockCount(); ++i) {
+        const size_t count = DecodeBlock(i, ordinals.data() + position, term_counts.data() + position);
+        std::fill_n(term_freq_bounds.begin() + position, count, GetBlockMaxTermFreq(i));
+        position += count;
+    }
+}
+
+void PostingList::EncodeAll(const std::vector<int>& ordinals, const std::vector<uint32_t>& term_counts,
+    const std::vector<double>& term_freq_bounds) {
+    blocks_ = {};
+    packed_ = {};
+    tail_ordinals_ = {};
+    tail_counts_ = {};
+    tail_max_term_freq_ = 0.0;
+    size_ = 0;
+    for (size_t i = 0; i < ordinals.size(); ++i) {
+        tail_ordinals_.Mutable().push_back(ordinals[i]);
+        tail_counts_.Mutable().push_back(term_counts[i]);
+        tail_max_term_freq_ = std::max(tail_max_term_freq_, term_freq_bounds[i]);
+        ++size_;
+        if (tail_ordinals_.size() == BLOCK_SIZE) {
+            SealTail();
+        }
+    }
+}
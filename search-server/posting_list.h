@@ -0,0 +1,169 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "snapshot.h"
+
+// Postings of a single word, sorted by document ordinal.
+// A posting keeps the number of occurrences of the word in the document, the shard turns it into
+// the term frequency with the document length. Postings are packed in blocks of BLOCK_SIZE:
+// ordinals as gaps from the previous one and occurrence counts, both with the smallest bit width
+// that fits the block, next to the largest term frequency of the block. The last, incomplete block is kept
+// unpacked so that appending stays cheap, until Seal packs it too
+class PostingList {
+public:
+    static constexpr size_t BLOCK_SIZE = 128;
+
+    // Forward-only position in a posting list, used to evaluate a query
+    // document by document. Decodes one block at a time
+    class Cursor {
+    public:
+        explicit Cursor(const PostingList& postings)
+            : postings_(&postings) {
+            LoadBlock(0);
+        }
+
+        bool IsEnd() const {
+            return position_ == size_;
+        }
+
+        int GetOrdinal() const {
+            return ordinals_[position_];
+        }
+
+        uint32_t GetTermCount() const {
+            return term_counts_[position_];
+        }
+
+        void Next() {
+            if (++position_ == size_) {
+                LoadBlock(block_index_ + 1);
+            }
+        }
+
+        // Moves to the first posting with ordinal not less than the given one.
+        // Whole blocks are skipped by their last ordinal without decoding them
+        void SkipTo(int ordinal);
+
+    private:
+        const PostingList* postings_;
+        size_t block_index_ = 0;
+        size_t position_ = 0;
+        size_t size_ = 0;
+        int ordinals_[BLOCK_SIZE];
+        uint32_t term_counts_[BLOCK_SIZE];
+
+        void LoadBlock(size_t block_index);
+    };
+
+    // Adds a posting; ordinal is usually greater than any stored one,
+    // in which case the posting is simply appended. term_freq only updates the upper bounds
+    void Add(int ordinal, uint32_t term_count, double term_freq);
+
+    // Packs the incomplete last block, for a list that is not going to grow; Add unpacks it again
+    void Seal();
+
+    // Replaces every stored ordinal with new_ordinals[ordinal], dropping the ones mapped to a negative number.
+    // The mapping must be increasing so that the list stays sorted
+    void Renumber(const std::vector<int>& new_ordinals);
+
+    size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    // Calls visitor(ordinal, term_count) for every posting in ordinal order
+    template <typename Visitor>
+    void ForEach(Visitor visitor) const;
+
+    // Blocks are numbered from 0, the unpacked tail being the last one.
+    // Every block but the last has BLOCK_SIZE postings
+    size_t GetBlockCount() const {
+        return blocks_.size() + (tail_ordinals_.empty() ? 0 : 1);
+    }
+
+    // Writes the postings of a block to the arrays of BLOCK_SIZE elements, returns their number
+    size_t DecodeBlock(size_t block_index, int* ordinals, uint32_t* term_counts) const;
+
+    // Upper bound of the term frequencies in the list; removals do not lower it
+    double GetMaxTermFreq() const {
+        return max_term_freq_;
+    }
+
+    // Upper bound of the term frequencies in a block, past the last block zero.
+    // Renumbering keeps the bounds of the blocks the postings came from
+    double GetBlockMaxTermFreq(size_t block_index) const {
+        return block_index < blocks_.size() ? blocks_[block_index].max_term_freq
+            : block_index == blocks_.size() ? tail_max_term_freq_ : 0.0;
+    }
+
+    // Memory allocated for the postings
+    size_t GetByteSize() const;
+
+    // The packed blocks are written as they are and read back in place, the list copies them on its first change.
+    // Load decodes every block once to check that its ordinals increase and stay below ordinal_count,
+    // and that no block bound exceeds the bound of the list
+    void Save(SnapshotWriter& writer) const;
+    void Load(SnapshotReader& reader, int ordinal_count);
+
+private:
+    struct Block {
+        double max_term_freq;
+        int first_ordinal;
+        int last_ordinal;
+        // start of the block in packed_: one gap less than postings, then the counts from a new byte
+        uint32_t offset;
+        uint8_t gap_bits;
+        uint8_t count_bits;
+    };
+
+    SnapshotArray<Block> blocks_;
+    SnapshotArray<uint8_t> packed_;
+    SnapshotArray<int> tail_ordinals_;
+    SnapshotArray<uint32_t> tail_counts_;
+    size_t size_ = 0;
+    double max_term_freq_ = 0.0;
+    double tail_max_term_freq_ = 0.0;
+
+    int GetBlockLastOrdinal(size_t block_index) const {
+        return block_index < blocks_.size() ? blocks_[block_index].last_ordinal : tail_ordinals_.back();
+    }
+
+    // Index of the first block from first_block on whose last ordinal is not less than the given one;
+    // first_block may be past the tail
+    size_t FindBlock(size_t first_block, int ordinal) const;
+
+    size_t GetBlockSize(size_t block_index) const;
+
+    // Packs the tail into a new block
+    void SealTail();
+
+    // Turns the last block, packed incomplete by Seal, back into the tail
+    void UnsealLastBlock();
+
+    // term_freq_bounds get the bound of the block of every posting
+    void DecodeAll(std::vector<int>& ordinals, std::vector<uint32_t>& term_counts, std::vector<double>& term_freq_bounds) const;
+
+    void EncodeAll(const std::vector<int>& ordinals, const std::vector<uint32_t>& term_counts,
+        const std::vector<double>& term_freq_bounds);
+};
+
+template <typename Visitor>
+void PostingList::ForEach(Visitor visitor) const {
+    for (size_t i = 0; i < blocks_.size(); ++i) {
+        int ordinals[BLOCK_SIZE];
+        uint32_t term_counts[BLOCK_SIZE];
+        const size_t count = DecodeBlock(i, ordinals, term_counts);
+        for (size_t j = 0; j < count; ++j) {
+            visitor(ordinals[j], term_counts[j]);
+        }
+    }
+    for (size_t j = 0; j < tail_ordinals_.size(); ++j) {
+        visitor(tail_ordinals_[j], tail_counts_[j]);
+    }
+}
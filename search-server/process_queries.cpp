@@ -1,26 +1,55 @@
 #include "process_queries.h"
 #include <execution>
 #include <algorithm>
+#include <utility>
 
 std::vector<std::vector<Document>> ProcessQueries(const SearchServer& search_server, const std::vector<std::string>& queries) {
-	std::vector<std::vector<Document>> documents_lists(queries.size());
-	transform(execution::par,
-		queries.begin(), queries.end(),
-		documents_lists.begin(),
-		[&search_server, &queries](const std::string query) {
-			return search_server.FindTopDocuments(query);
-		}
-	);
-	return documents_lists;
-}
-
-std::list<Document> ProcessQueriesJoined(const SearchServer& search_server, const std::vector<std::string>& queries) {
-	std::vector<std::vector<Document>> documents_lists = ProcessQueries(search_server, queries);
-	std::list<Document> docs;
-	for (const auto& documents : documents_lists) {
-		for (const auto& doc : documents) {
-			docs.push_back(doc);
-		}
+	const std::vector<std::string_view> raw_queries(queries.begin(), queries.end());
+	return search_server.FindTopDocumentsBatch(raw_queries);
+}
+
+JoinedDocuments ProcessQueriesJoined(const SearchServer& search_server, const std::vector<std::string>& queries) {
+	return JoinedDocuments(ProcessQueries(search_server, queries));
+}
+
+JoinedDocuments::Iterator::Iterator(std::vector<std::vector<Document>>::const_iterator list,
+	std::vector<std::vector<Document>>::const_iterator lists_end)
+	: list_(list), lists_end_(lists_end) {
+	SkipEmptyLists();
+}
+
+JoinedDocuments::Iterator& JoinedDocuments::Iterator::operator++() {
+	if (++index_ == list_->size()) {
+		++list_;
+		index_ = 0;
+		SkipEmptyLists();
 	}
-	return docs;
-}
\ No newline at end of file
+	return *this;
+}
+
+JoinedDocuments::Iterator JoinedDocuments::Iterator::operator++(int) {
+	Iterator old = *this;
+	++*this;
+	return old;
+}
+
+void JoinedDocuments::Iterator::SkipEmptyLists() {
+	while (list_ != lists_end_ && list_->empty()) {
+		++list_;
+	}
+}
+
+JoinedDocuments::JoinedDocuments(std::vector<std::vector<Document>> documents_lists)
+	: documents_lists_(std::move(documents_lists)) {
+	for (const auto& documents : documents_lists_) {
+		size_ += documents.size();
+	}
+}
+
+JoinedDocuments::Iterator JoinedDocuments::begin() const {
+	return Iterator(documents_lists_.begin(), documents_lists_.end());
+}
+
+JoinedDocuments::Iterator JoinedDocuments::end() const {
+	return Iterator(documents_lists_.end(), documents_lists_.end());
+}
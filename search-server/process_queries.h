@@ -1,12 +1,95 @@
 #pragma once
 
 #include "search_server.h"
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
 #include <vector>
 #include <string>
-#include <list>
+#include <string_view>
 
 using namespace std;
 
+// Documents found for a batch of queries, walked as one sequence in query order.
+// The documents stay in the per-query vectors they were found in, nothing is copied
+class JoinedDocuments {
+public:
+	class Iterator {
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = Document;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const Document*;
+		using reference = const Document&;
+
+		Iterator() = default;
+		Iterator(std::vector<std::vector<Document>>::const_iterator list, std::vector<std::vector<Document>>::const_iterator lists_end);
+
+		reference operator*() const {
+			return (*list_)[index_];
+		}
+
+		pointer operator->() const {
+			return &(*list_)[index_];
+		}
+
+		Iterator& operator++();
+		Iterator operator++(int);
+
+		bool operator==(const Iterator& other) const {
+			return list_ == other.list_ && index_ == other.index_;
+		}
+
+		bool operator!=(const Iterator& other) const {
+			return !(*this == other);
+		}
+
+	private:
+		std::vector<std::vector<Document>>::const_iterator list_;
+		std::vector<std::vector<Document>>::const_iterator lists_end_;
+		size_t index_ = 0;
+
+		void SkipEmptyLists();
+	};
+
+	explicit JoinedDocuments(std::vector<std::vector<Document>> documents_lists);
+
+	Iterator begin() const;
+	Iterator end() const;
+
+	size_t size() const {
+		return size_;
+	}
+
+	bool empty() const {
+		return size_ == 0;
+	}
+
+private:
+	std::vector<std::vector<Document>> documents_lists_;
+	size_t size_ = 0;
+};
+
+// Number of queries ProcessQueriesJoined answers at once when streaming
+const size_t PROCESS_QUERIES_CHUNK_SIZE = 1024;
+
 vector<vector<Document>> ProcessQueries(const SearchServer &s, const vector<string> &queries);
 
-list<Document> ProcessQueriesJoined(const SearchServer& search_server, const std::vector<std::string>& queries);
\ No newline at end of file
+JoinedDocuments ProcessQueriesJoined(const SearchServer& search_server, const std::vector<std::string>& queries);
+
+// Calls callback(document) for every document found, in query order.
+// The queries are answered chunk by chunk, so only the results of one chunk are held in memory
+template <typename Callback>
+void ProcessQueriesJoined(const SearchServer& search_server, const std::vector<std::string>& queries, Callback callback) {
+	std::vector<std::string_view> chunk;
+	chunk.reserve(std::min(queries.size(), PROCESS_QUERIES_CHUNK_SIZE));
+	for (size_t first = 0; first < queries.size(); first += PROCESS_QUERIES_CHUNK_SIZE) {
+		const size_t last = std::min(queries.size(), first + PROCESS_QUERIES_CHUNK_SIZE);
+		chunk.assign(queries.begin() + first, queries.begin() + last);
+		for (const auto& documents : search_server.FindTopDocumentsBatch(chunk)) {
+			for (const Document& document : documents) {
+				callback(document);
+			}
+		}
+	}
+}
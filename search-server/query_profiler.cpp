@@ -0,0 +1,254 @@
+#include "query_profiler.h"
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <unordered_map>
+
+namespace {
+
+struct MetricInfo {
+    const char* json_name;
+    const char* prometheus_name;
+    const char* help;
+    // nanoseconds, exported to Prometheus in seconds
+    bool is_time;
+};
+
+const MetricInfo METRICS[] = {
+    { "parse_ns", "search_server_query_parse_seconds", "Time to parse a raw query", true },
+    { "search_ns", "search_server_query_search_seconds", "Time to search the index and rank the result", true },
+    { "postings_scanned", "search_server_query_postings_scanned", "Postings read from the lists of the query words", false },
+    { "documents_scored", "search_server_query_documents_scored", "Documents that got a relevance", false },
+    { "candidates_sorted", "search_server_query_candidates_sorted", "Documents offered to the top of the result", false },
+    { "minus_eliminations", "search_server_query_minus_eliminations", "Documents with a plus word dropped for a minus word", false },
+};
+
+// Prometheus gets the buckets up to 2^40 - 1, about 18 minutes in nanoseconds; larger values only reach +Inf
+const size_t EXPORTED_BUCKET_COUNT = 41;
+
+std::atomic<uint64_t> next_profiler_id{ 1 };
+
+int GetBitWidth(uint64_t value) {
+    int bits = 0;
+    while (bits < 64 && (value >> bits) != 0) {
+        ++bits;
+    }
+    return bits;
+}
+
+uint64_t GetBucketBound(size_t bucket) {
+    return bucket >= 64 ? UINT64_MAX : (static_cast<uint64_t>(1) << bucket) - 1;
+}
+
+void WriteJsonString(std::ostream& output, std::string_view str) {
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+    output << '"';
+    for (const char c : str) {
+        if (c == '"' || c == '\\') {
+            output << '\\' << c;
+        }
+        else if (static_cast<unsigned char>(c) < ' ') {
+            output << "\\u00" << HEX_DIGITS[c >> 4] << HEX_DIGITS[c & 0xf];
+        }
+        else {
+            output << c;
+        }
+    }
+    output << '"';
+}
+
+void WriteJsonStats(std::ostream& output, const QueryStats& stats) {
+    output << "\"parse_ns\":" << stats.parse_ns << ",\"search_ns\":" << stats.search_ns
+        << ",\"postings_scanned\":" << stats.postings_scanned << ",\"documents_scored\":" << stats.documents_scored
+        << ",\"candidates_sorted\":" << stats.candidates_sorted << ",\"minus_eliminations\":" << stats.minus_eliminations;
+}
+
+// Counts are written as integers and nanoseconds as seconds with all nine decimals that matter,
+// so that no bucket bound or sum is rounded
+void WritePrometheusValue(std::ostream& output, uint64_t value, bool is_time) {
+    if (!is_time) {
+        output << value;
+        return;
+    }
+    output << value / 1'000'000'000;
+    const uint64_t nanoseconds = value % 1'000'000'000;
+    if (nanoseconds != 0) {
+        std::string digits = std::to_string(nanoseconds);
+        digits.insert(0, 9 - digits.size(), '0');
+        digits.erase(digits.find_last_not_of('0') + 1);
+        output << '.' << digits;
+    }
+}
+
+bool IsFaster(const SlowQuery& lhs, const SlowQuery& rhs) {
+    return lhs.stats.parse_ns + lhs.stats.search_ns > rhs.stats.parse_ns + rhs.stats.search_ns;
+}
+
+} // namespace
+
+void QueryProfiler::Histogram::Add(uint64_t value) {
+    // the only writer, a plain load and store is enough
+    auto& bucket = buckets[GetBitWidth(value)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    sum.store(sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    if (value > max.load(std::memory_order_relaxed)) {
+        max.store(value, std::memory_order_relaxed);
+    }
+}
+
+uint64_t QueryProfiler::Summary::GetPercentile(double share) const {
+    const auto rank = static_cast<uint64_t>(std::ceil(share * count));
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+        seen += buckets[bucket];
+        if (seen >= rank && seen > 0) {
+            return std::min(GetBucketBound(bucket), max);
+        }
+    }
+    return max;
+}
+
+QueryProfiler::QueryProfiler(size_t slow_query_count) :
+    id_(next_profiler_id.fetch_add(1)), slow_query_count_(slow_query_count) {
+}
+
+bool QueryProfiler::IsSlow(const QueryStats& stats) const {
+    return slow_query_count_ > 0 && GetTotalNs(stats) > slow_threshold_ns_.load(std::memory_order_relaxed);
+}
+
+void QueryProfiler::Record(std::string_view query, const QueryStats& stats) {
+    auto& metrics = GetThreadHistograms().metrics;
+    metrics[PARSE_NS].Add(stats.parse_ns);
+    metrics[SEARCH_NS].Add(stats.search_ns);
+    metrics[POSTINGS_SCANNED].Add(stats.postings_scanned);
+    metrics[DOCUMENTS_SCORED].Add(stats.documents_scored);
+    metrics[CANDIDATES_SORTED].Add(stats.candidates_sorted);
+    metrics[MINUS_ELIMINATIONS].Add(stats.minus_eliminations);
+    if (!IsSlow(stats)) {
+        return;
+    }
+    const std::lock_guard lock(mutex_);
+    if (slow_queries_.size() == slow_query_count_) {
+        if (GetTotalNs(stats) <= GetTotalNs(slow_queries_.front().stats)) {
+            return;
+        }
+        std::pop_heap(slow_queries_.begin(), slow_queries_.end(), IsFaster);
+        slow_queries_.pop_back();
+    }
+    slow_queries_.push_back({ std::string(query), stats });
+    std::push_heap(slow_queries_.begin(), slow_queries_.end(), IsFaster);
+    if (slow_queries_.size() == slow_query_count_) {
+        slow_threshold_ns_.store(GetTotalNs(slow_queries_.front().stats), std::memory_order_relaxed);
+    }
+}
+
+uint64_t QueryProfiler::GetQueryCount() const {
+    return Summarize(SEARCH_NS).count;
+}
+
+std::vector<SlowQuery> QueryProfiler::GetSlowQueries() const {
+    std::vector<SlowQuery> slow_queries;
+    {
+        const std::lock_guard lock(mutex_);
+        slow_queries = slow_queries_;
+    }
+    std::sort(slow_queries.begin(), slow_queries.end(), IsFaster);
+    return slow_queries;
+}
+
+std::string QueryProfiler::ExportJson() const {
+    std::ostringstream output;
+    output << "{\"queries\":" << GetQueryCount() << ",\"metrics\":{";
+    for (int metric = 0; metric < METRIC_COUNT; ++metric) {
+        const Summary summary = Summarize(static_cast<Metric>(metric));
+        output << (metric > 0 ? "," : "") << '"' << METRICS[metric].json_name << "\":{\"count\":" << summary.count
+            << ",\"sum\":" << summary.sum << ",\"max\":" << summary.max << ",\"p50\":" << summary.GetPercentile(0.5)
+            << ",\"p90\":" << summary.GetPercentile(0.9) << ",\"p99\":" << summary.GetPercentile(0.99) << ",\"buckets\":[";
+        bool is_first = true;
+        for (size_t bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+            if (summary.buckets[bucket] > 0) {
+                output << (is_first ? "" : ",") << "{\"le\":" << GetBucketBound(bucket) << ",\"count\":" << summary.buckets[bucket] << '}';
+                is_first = false;
+            }
+        }
+        output << "]}";
+    }
+    output << "},\"slow_queries\":[";
+    bool is_first = true;
+    for (const SlowQuery& slow_query : GetSlowQueries()) {
+        output << (is_first ? "" : ",") << "{\"query\":";
+        WriteJsonString(output, slow_query.query);
+        output << ',';
+        WriteJsonStats(output, slow_query.stats);
+        output << '}';
+        is_first = false;
+    }
+    output << "]}";
+    return output.str();
+}
+
+std::string QueryProfiler::ExportPrometheus() const {
+    std::ostringstream output;
+    for (int metric = 0; metric < METRIC_COUNT; ++metric) {
+        const MetricInfo& info = METRICS[metric];
+        const Summary summary = Summarize(static_cast<Metric>(metric));
+        output << "# HELP " << info.prometheus_name << ' ' << info.help << '\n';
+        output << "# TYPE " << info.prometheus_name << " histogram\n";
+        uint64_t cumulative_count = 0;
+        for (size_t bucket = 0; bucket < EXPORTED_BUCKET_COUNT; ++bucket) {
+            cumulative_count += summary.buckets[bucket];
+            output << info.prometheus_name << "_bucket{le=\"";
+            WritePrometheusValue(output, GetBucketBound(bucket), info.is_time);
+            output << "\"} " << cumulative_count << '\n';
+        }
+        output << info.prometheus_name << "_bucket{le=\"+Inf\"} " << summary.count << '\n';
+        output << info.prometheus_name << "_sum ";
+        WritePrometheusValue(output, summary.sum, info.is_time);
+        output << '\n';
+        output << info.prometheus_name << "_count " << summary.count << '\n';
+    }
+    return output.str();
+}
+
+void QueryProfiler::Reset() {
+    const std::lock_guard lock(mutex_);
+    for (const auto& histograms : thread_histograms_) {
+        for (Histogram& histogram : histograms->metrics) {
+            for (auto& bucket : histogram.buckets) {
+                bucket.store(0, std::memory_order_relaxed);
+            }
+            histogram.sum.store(0, std::memory_order_relaxed);
+            histogram.max.store(0, std::memory_order_relaxed);
+        }
+    }
+    slow_queries_.clear();
+    slow_threshold_ns_.store(0, std::memory_order_relaxed);
+}
+
+QueryProfiler::ThreadHistograms& QueryProfiler::GetThreadHistograms() {
+    // profiler ids are never reused, so an entry left by a destroyed profiler is never looked up again
+    thread_local std::unordered_map<uint64_t, ThreadHistograms*> thread_histograms;
+    ThreadHistograms*& histograms = thread_histograms[id_];
+    if (histograms == nullptr) {
+        const std::lock_guard lock(mutex_);
+        thread_histograms_.push_back(std::make_unique<ThreadHistograms>());
+        histograms = thread_histograms_.back().get();
+    }
+    return *histograms;
+}
+
+QueryProfiler::Summary QueryProfiler::Summarize(Metric metric) const {
+    Summary summary;
+    const std::lock_guard lock(mutex_);
+    for (const auto& histograms : thread_histograms_) {
+        const Histogram& histogram = histograms->metrics[metric];
+        for (size_t bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+            const uint64_t count = histogram.buckets[bucket].load(std::memory_order_relaxed);
+            summary.buckets[bucket] += count;
+            summary.count += count;
+        }
+        summary.sum += histogram.sum.load(std::memory_order_relaxed);
+        summary.max = std::max(summary.max, histogram.max.load(std::memory_order_relaxed));
+    }
+    return summary;
+}
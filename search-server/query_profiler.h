@@ -0,0 +1,130 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// What one query cost. The shards count the work, the server adds the time
+struct QueryStats {
+    // zero for a prepared query
+    uint64_t parse_ns = 0;
+    uint64_t search_ns = 0;
+    // postings read from the lists of the plus and minus words
+    uint64_t postings_scanned = 0;
+    // documents that got a relevance
+    uint64_t documents_scored = 0;
+    // documents offered to the top of the result
+    uint64_t candidates_sorted = 0;
+    // documents with a plus word dropped for a minus word
+    uint64_t minus_eliminations = 0;
+
+    QueryStats& operator+=(const QueryStats& other) {
+        parse_ns += other.parse_ns;
+        search_ns += other.search_ns;
+        postings_scanned += other.postings_scanned;
+        documents_scored += other.documents_scored;
+        candidates_sorted += other.candidates_sorted;
+        minus_eliminations += other.minus_eliminations;
+        return *this;
+    }
+};
+
+struct SlowQuery {
+    std::string query;
+    QueryStats stats;
+};
+
+// Collects the stats of the queries of a server into histograms with power-of-two buckets.
+// Every thread records into histograms of its own, so recording takes no lock;
+// they are summed up on export. The slowest queries are kept with their text
+class QueryProfiler {
+public:
+    explicit QueryProfiler(size_t slow_query_count = 10);
+
+    QueryProfiler(const QueryProfiler&) = delete;
+    QueryProfiler& operator=(const QueryProfiler&) = delete;
+
+    static uint64_t Now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Whether a query with these stats would be kept among the slowest ones
+    bool IsSlow(const QueryStats& stats) const;
+
+    void Record(std::string_view query, const QueryStats& stats);
+
+    uint64_t GetQueryCount() const;
+
+    // From the slowest
+    std::vector<SlowQuery> GetSlowQueries() const;
+
+    // Count, sum, max and percentiles of every stat, and the slowest queries
+    std::string ExportJson() const;
+
+    // Prometheus text format: a histogram per stat, counts as integers and times in exact decimal seconds
+    std::string ExportPrometheus() const;
+
+    // Records made while it runs may be partly lost
+    void Reset();
+
+private:
+    enum Metric {
+        PARSE_NS,
+        SEARCH_NS,
+        POSTINGS_SCANNED,
+        DOCUMENTS_SCORED,
+        CANDIDATES_SORTED,
+        MINUS_ELIMINATIONS,
+        METRIC_COUNT,
+    };
+
+    // bucket i holds the values of i bits, from 2^(i-1) to 2^i - 1
+    static constexpr size_t BUCKET_COUNT = 65;
+
+    // Written by one thread only, read by the export
+    struct Histogram {
+        std::array<std::atomic<uint64_t>, BUCKET_COUNT> buckets{};
+        std::atomic<uint64_t> sum{ 0 };
+        std::atomic<uint64_t> max{ 0 };
+
+        void Add(uint64_t value);
+    };
+
+    struct ThreadHistograms {
+        std::array<Histogram, METRIC_COUNT> metrics;
+    };
+
+    struct Summary {
+        std::array<uint64_t, BUCKET_COUNT> buckets{};
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t max = 0;
+
+        // Upper bound of the bucket the percentile falls into
+        uint64_t GetPercentile(double share) const;
+    };
+
+    // tells the thread-local histograms of different profilers apart
+    uint64_t id_;
+    size_t slow_query_count_;
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<ThreadHistograms>> thread_histograms_;
+    // a heap with the fastest of the kept queries on top
+    std::vector<SlowQuery> slow_queries_;
+    std::atomic<uint64_t> slow_threshold_ns_{ 0 };
+
+    ThreadHistograms& GetThreadHistograms();
+
+    Summary Summarize(Metric metric) const;
+
+    static uint64_t GetTotalNs(const QueryStats& stats) {
+        return stats.parse_ns + stats.search_ns;
+    }
+};
@@ -1,28 +1,329 @@
 #include "remove_duplicates.h"
+#include <algorithm>
+#include <execution>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <numeric>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
 
 void AddDocument(SearchServer& searchServer, int doc_id, const std::string& document, DocumentStatus status, const std::vector<int>& ratings) {
     searchServer.AddDocument(doc_id, document, status, ratings);
 }
 
-void RemoveDuplicates(SearchServer& search_server) {
-    std::vector<int> ids;
-    std::map<std::set<std::string>, int> document_to_id;
-    for (const int document_id : search_server) {
-        std::map<std::string, double> words_freqs = search_server.GetWordFrequencies(document_id);
-        std::set<std::string> words;
-        for (auto [word, freq] : words_freqs) {
-            words.insert(word);
-        }
+namespace {
+
+uint64_t MixTermId(uint32_t term_id) {
+    // splitmix64 finalizer, spreads neighbouring ids over the whole range
+    uint64_t x = term_id + 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+// A sum does not depend on the order of the words
+uint64_t ComputeFingerprint(const SnapshotArray<TermFreq>& term_freqs) {
+    uint64_t fingerprint = 0;
+    for (const TermFreq& term_freq : term_freqs) {
+        fingerprint += MixTermId(term_freq.term_id);
+    }
+    return fingerprint;
+}
 
-        if (document_to_id.count(words) == 0) {
-            document_to_id.insert({words, document_id});
+bool HaveSameWords(const SnapshotArray<TermFreq>& lhs, const SnapshotArray<TermFreq>& rhs) {
+    return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), [](const TermFreq& lhs, const TermFreq& rhs) {
+        return lhs.term_id == rhs.term_id;
+    });
+}
+
+double ComputeJaccard(const SnapshotArray<TermFreq>& lhs, const SnapshotArray<TermFreq>& rhs) {
+    if (lhs.empty() && rhs.empty()) {
+        return 1.0;
+    }
+    size_t common_count = 0;
+    auto lhs_iter = lhs.begin();
+    auto rhs_iter = rhs.begin();
+    while (lhs_iter != lhs.end() && rhs_iter != rhs.end()) {
+        if (lhs_iter->term_id < rhs_iter->term_id) {
+            ++lhs_iter;
+        }
+        else if (rhs_iter->term_id < lhs_iter->term_id) {
+            ++rhs_iter;
         }
         else {
+            ++common_count;
+            ++lhs_iter;
+            ++rhs_iter;
+        }
+    }
+    return static_cast<double>(common_count) / (lhs.size() + rhs.size() - common_count);
+}
+
+// The i-th value is the minimum of the i-th hash function over the words of the document.
+// The hash functions are a * h + b over one mixed hash h of the term id
+std::vector<uint64_t> ComputeMinHashSignature(const SnapshotArray<TermFreq>& term_freqs,
+    const std::vector<std::pair<uint64_t, uint64_t>>& hash_coefficients) {
+    std::vector<uint64_t> signature(hash_coefficients.size(), UINT64_MAX);
+    for (const TermFreq& term_freq : term_freqs) {
+        const uint64_t term_hash = MixTermId(term_freq.term_id);
+        for (size_t i = 0; i < hash_coefficients.size(); ++i) {
+            signature[i] = std::min(signature[i], hash_coefficients[i].first * term_hash + hash_coefficients[i].second);
+        }
+    }
+    return signature;
+}
+
+} // namespace
+
+void RemoveDuplicates(SearchServer& search_server) {
+    DuplicateDetector().RemoveDuplicates(search_server);
+}
+
+void DuplicateDetector::RemoveDuplicates(SearchServer& search_server) {
+    if (search_server.GetGeneration() == checked_generation_) {
+        return;
+    }
+    // every fingerprint is taken again: a document added again under a known id may have other words
+    const std::vector<int> document_ids(search_server.begin(), search_server.end());
+    std::vector<uint64_t> fingerprints(document_ids.size());
+    std::transform(std::execution::par,
+        document_ids.begin(), document_ids.end(),
+        fingerprints.begin(),
+        [&search_server](int document_id) {
+            return ComputeFingerprint(search_server.GetTermFrequencies(document_id));
+        });
+    ForgetChangedDocuments(document_ids, fingerprints);
+
+    // the documents go in the server's order, so the earliest of the equal ones stays
+    std::vector<int> ids;
+    for (size_t i = 0; i < document_ids.size(); ++i) {
+        const int document_id = document_ids[i];
+        if (checked_documents_.count(document_id) > 0) {
+            continue;
+        }
+        auto& same_fingerprint_ids = fingerprint_documents_[fingerprints[i]];
+        const auto& term_freqs = search_server.GetTermFrequencies(document_id);
+        const bool is_duplicate = std::any_of(same_fingerprint_ids.begin(), same_fingerprint_ids.end(), [&](int other_id) {
+            return HaveSameWords(term_freqs, search_server.GetTermFrequencies(other_id));
+        });
+        if (is_duplicate) {
             ids.push_back(document_id);
             std::cout << "Found duplicate document id " << document_id << std::endl;
         }
+        else {
+            same_fingerprint_ids.push_back(document_id);
+            checked_documents_.emplace(document_id, CheckedDocument{ fingerprints[i], next_order_++ });
+        }
+    }
+    search_server.RemoveDocuments(ids);
+    checked_generation_ = search_server.GetGeneration();
+}
+
+void DuplicateDetector::ForgetChangedDocuments(const std::vector<int>& document_ids, const std::vector<uint64_t>& fingerprints) {
+    if (checked_documents_.empty()) {
+        return;
+    }
+    // a document is unchanged if it has the same words and keeps its place: before every new
+    // document and after the unchanged documents checked before it
+    std::unordered_map<int, uint64_t> unchanged_orders;
+    uint64_t last_order = 0;
+    for (size_t i = 0; i < document_ids.size(); ++i) {
+        const auto checked_iter = checked_documents_.find(document_ids[i]);
+        if (checked_iter == checked_documents_.end()) {
+            break;
+        }
+        const CheckedDocument& checked = checked_iter->second;
+        if (checked.fingerprint == fingerprints[i] && (unchanged_orders.empty() || checked.order > last_order)) {
+            unchanged_orders.emplace(document_ids[i], checked.order);
+            last_order = checked.order;
+        }
+    }
+    for (auto iter = checked_documents_.begin(); iter != checked_documents_.end();) {
+        if (unchanged_orders.count(iter->first) > 0) {
+            ++iter;
+            continue;
+        }
+        auto& same_fingerprint_ids = fingerprint_documents_[iter->second.fingerprint];
+        same_fingerprint_ids.erase(std::find(same_fingerprint_ids.begin(), same_fingerprint_ids.end(), iter->first));
+        if (same_fingerprint_ids.empty()) {
+            fingerprint_documents_.erase(iter->second.fingerprint);
+        }
+        iter = checked_documents_.erase(iter);
     }
-    for (auto id : ids) {
-        search_server.RemoveDocument(id);
+}
+
+std::vector<std::vector<int>> FindNearDuplicates(const SearchServer& search_server, const NearDuplicateOptions& options) {
+    using namespace std;
+    if (!(options.jaccard_threshold > 0.0 && options.jaccard_threshold <= 1.0)
+        || options.band_count == 0 || options.rows_per_band == 0 || options.bucket_representative_count == 0) {
+        throw invalid_argument("Invalid near duplicate options"s);
+    }
+    const vector<int> document_ids(search_server.begin(), search_server.end());
+    // documents without words would all share one signature; their word sets are equal anyway
+    vector<size_t> empty_indexes;
+    vector<size_t> word_indexes;
+    for (size_t i = 0; i < document_ids.size(); ++i) {
+        (search_server.GetTermFrequencies(document_ids[i]).empty() ? empty_indexes : word_indexes).push_back(i);
+    }
+    const size_t signature_size = options.band_count * options.rows_per_band;
+    vector<pair<uint64_t, uint64_t>> hash_coefficients(signature_size);
+    for (size_t i = 0; i < signature_size; ++i) {
+        hash_coefficients[i] = { MixTermId(static_cast<uint32_t>(2 * i)) | 1, MixTermId(static_cast<uint32_t>(2 * i + 1)) };
+    }
+    vector<vector<uint64_t>> signatures(word_indexes.size());
+    transform(execution::par,
+        word_indexes.begin(), word_indexes.end(),
+        signatures.begin(),
+        [&](size_t i) {
+            return ComputeMinHashSignature(search_server.GetTermFrequencies(document_ids[i]), hash_coefficients);
+        });
+
+    // Bands are independent: each one links every document to the first one with the same hash
+    // of its part of the signature
+    vector<vector<pair<size_t, size_t>>> band_links(options.band_count);
+    // the hash of every band of every document, to find its buckets again inside the group
+    vector<uint64_t> band_hashes(document_ids.size() * options.band_count);
+    vector<size_t> bands(options.band_count);
+    iota(bands.begin(), bands.end(), 0);
+    for_each(execution::par,
+        bands.begin(), bands.end(),
+        [&](size_t band) {
+            unordered_map<uint64_t, size_t> bucket_heads;
+            bucket_heads.reserve(word_indexes.size());
+            for (size_t k = 0; k < word_indexes.size(); ++k) {
+                // FNV-1a over the values; a collision only joins two groups, whose documents are verified anyway
+                uint64_t band_hash = 0xcbf29ce484222325ull;
+                for (size_t row = 0; row < options.rows_per_band; ++row) {
+                    band_hash = (band_hash ^ signatures[k][band * options.rows_per_band + row]) * 0x100000001b3ull;
+                }
+                // the bands do not share buckets
+                band_hashes[word_indexes[k] * options.band_count + band] = band_hash ^ MixTermId(static_cast<uint32_t>(band));
+                const auto [head_iter, is_new] = bucket_heads.emplace(band_hash, word_indexes[k]);
+                if (!is_new) {
+                    band_links[band].emplace_back(head_iter->second, word_indexes[k]);
+                }
+            }
+        });
+    // Union-find: documents linked in any band form a group, rooted at its earliest document
+    vector<size_t> parents(document_ids.size());
+    iota(parents.begin(), parents.end(), 0);
+    const auto find_root = [&parents](size_t i) {
+        while (parents[i] != i) {
+            parents[i] = parents[parents[i]];
+            i = parents[i];
+        }
+        return i;
+    };
+    for (const auto& links : band_links) {
+        for (const auto& [head, i] : links) {
+            const size_t head_root = find_root(head);
+            const size_t root = find_root(i);
+            parents[max(head_root, root)] = min(head_root, root);
+        }
+    }
+    vector<size_t> group_sizes(document_ids.size(), 0);
+    for (const size_t i : word_indexes) {
+        ++group_sizes[find_root(i)];
+    }
+    const size_t NO_GROUP = SIZE_MAX;
+    vector<size_t> root_groups(document_ids.size(), NO_GROUP);
+    vector<vector<size_t>> groups;
+    for (const size_t i : word_indexes) {
+        const size_t root = find_root(i);
+        if (group_sizes[root] < 2) {
+            continue;
+        }
+        if (root_groups[root] == NO_GROUP) {
+            root_groups[root] = groups.size();
+            groups.emplace_back().reserve(group_sizes[root]);
+        }
+        groups[root_groups[root]].push_back(i);
+    }
+
+    // A document joins the earliest similar document that is not a near duplicate itself, among
+    // the representatives of its buckets: the first kept documents that fell into each of them
+    vector<vector<vector<size_t>>> group_clusters(groups.size());
+    vector<size_t> group_indexes(groups.size());
+    iota(group_indexes.begin(), group_indexes.end(), 0);
+    for_each(execution::par,
+        group_indexes.begin(), group_indexes.end(),
+        [&](size_t group_index) {
+            const size_t NO_CLUSTER = SIZE_MAX;
+            // kept documents are numbered in the group in the server's order
+            vector<size_t> kept;
+            vector<const SnapshotArray<TermFreq>*> kept_term_freqs;
+            vector<size_t> kept_clusters;
+            unordered_map<uint64_t, vector<size_t>> bucket_representatives;
+            vector<size_t> candidates;
+            auto& clusters = group_clusters[group_index];
+            for (const size_t i : groups[group_index]) {
+                const uint64_t* hashes = &band_hashes[i * options.band_count];
+                candidates.clear();
+                for (size_t band = 0; band < options.band_count; ++band) {
+                    const auto iter = bucket_representatives.find(hashes[band]);
+                    if (iter != bucket_representatives.end()) {
+                        candidates.insert(candidates.end(), iter->second.begin(), iter->second.end());
+                    }
+                }
+                sort(candidates.begin(), candidates.end());
+                candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+                const auto& term_freqs = search_server.GetTermFrequencies(document_ids[i]);
+                const auto head_iter = find_if(candidates.begin(), candidates.end(), [&](size_t candidate) {
+                    return ComputeJaccard(term_freqs, *kept_term_freqs[candidate]) >= options.jaccard_threshold;
+                });
+                if (head_iter == candidates.end()) {
+                    for (size_t band = 0; band < options.band_count; ++band) {
+                        auto& representatives = bucket_representatives[hashes[band]];
+                        if (representatives.size() < options.bucket_representative_count) {
+                            representatives.push_back(kept.size());
+                        }
+                    }
+                    kept.push_back(i);
+                    kept_term_freqs.push_back(&term_freqs);
+                    kept_clusters.push_back(NO_CLUSTER);
+                    continue;
+                }
+                const size_t head = *head_iter;
+                size_t& cluster = kept_clusters[head];
+                if (cluster == NO_CLUSTER) {
+                    cluster = clusters.size();
+                    clusters.push_back({ kept[head] });
+                }
+                clusters[cluster].push_back(i);
+            }
+        });
+
+    vector<vector<size_t>> index_clusters;
+    for (auto& clusters : group_clusters) {
+        move(clusters.begin(), clusters.end(), back_inserter(index_clusters));
+    }
+    if (empty_indexes.size() > 1) {
+        index_clusters.push_back(move(empty_indexes));
+    }
+    // in the order their first near duplicates come in the server
+    sort(index_clusters.begin(), index_clusters.end(), [](const vector<size_t>& lhs, const vector<size_t>& rhs) {
+        return lhs[1] < rhs[1];
+    });
+    vector<vector<int>> clusters(index_clusters.size());
+    for (size_t i = 0; i < index_clusters.size(); ++i) {
+        for (const size_t index : index_clusters[i]) {
+            clusters[i].push_back(document_ids[index]);
+        }
+    }
+    return clusters;
+}
+
+void RemoveNearDuplicates(SearchServer& search_server, const NearDuplicateOptions& options) {
+    std::vector<int> ids;
+    for (const auto& cluster : FindNearDuplicates(search_server, options)) {
+        std::cout << "Found near duplicates of document id " << cluster.front() << ":";
+        for (size_t i = 1; i < cluster.size(); ++i) {
+            std::cout << ' ' << cluster[i];
+            ids.push_back(cluster[i]);
+        }
+        std::cout << std::endl;
     }
+    search_server.RemoveDocuments(ids);
 }
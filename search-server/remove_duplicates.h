@@ -2,8 +2,58 @@
 
 #include "search_server.h"
 #include "document.h"
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
 
 //-
 void AddDocument(SearchServer& searchServer, int doc_id, const std::string& document, DocumentStatus status, const std::vector<int>& ratings);
 
 void RemoveDuplicates(SearchServer& search_server);
+
+// Finds documents with the same set of words as an earlier document and removes them.
+// Remembers the documents it has checked, so a later call only compares the documents added since.
+// A document removed and added again under the same id is checked again: its words or its place
+// in the server's order differ from the remembered ones. A call on an unchanged server does nothing
+class DuplicateDetector {
+public:
+    void RemoveDuplicates(SearchServer& search_server);
+
+private:
+    struct CheckedDocument {
+        uint64_t fingerprint;
+        // grows in the server's order; documents added later come after every checked one
+        uint64_t order;
+    };
+
+    // documents by the fingerprint of their word set
+    std::unordered_map<uint64_t, std::vector<int>> fingerprint_documents_;
+    std::unordered_map<int, CheckedDocument> checked_documents_;
+    uint64_t next_order_ = 0;
+    // generation of the server after the previous call
+    uint64_t checked_generation_ = 0;
+
+    void ForgetChangedDocuments(const std::vector<int>& document_ids, const std::vector<uint64_t>& fingerprints);
+};
+
+// MinHash signatures of band_count * rows_per_band values are split into bands; documents agreeing
+// on a whole band fall into one group, and only documents of a group are compared by their word sets.
+// A pair with Jaccard similarity s shares a group with probability at least 1 - (1 - s^rows_per_band)^band_count.
+// A document is compared with at most bucket_representative_count documents of each of its band buckets,
+// the earliest ones that are not near duplicates, so a group of any size takes linear time
+struct NearDuplicateOptions {
+    double jaccard_threshold = 0.8;
+    size_t band_count = 20;
+    size_t rows_per_band = 5;
+    size_t bucket_representative_count = 4;
+};
+
+// Clusters of near-duplicate documents. Every document of a cluster has Jaccard similarity
+// of at least the threshold with the first one, which is the earliest in the server's order.
+// Documents without words, empty or of stop words only, are one cluster. Documents without
+// near duplicates are not reported. Throws std::invalid_argument on bad options
+std::vector<std::vector<int>> FindNearDuplicates(const SearchServer& search_server,
+    const NearDuplicateOptions& options = NearDuplicateOptions());
+
+// Prints the clusters, then keeps only the first document of each
+void RemoveNearDuplicates(SearchServer& search_server, const NearDuplicateOptions& options = NearDuplicateOptions());
@@ -5,14 +5,24 @@ RequestQueue::RequestQueue(const SearchServer& search_server) :
     time_(0) {
 }
 
+RequestQueue::RequestQueue(ResultCache& result_cache) :
+    searchServer_(result_cache.GetSearchServer()),
+    resultCache_(&result_cache),
+    time_(0) {
+}
+
 std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query, DocumentStatus status) {
-    const auto docs = searchServer_.FindTopDocuments(raw_query, status);
+    const auto docs = resultCache_ != nullptr
+        ? resultCache_->FindTopDocuments(raw_query, status)
+        : searchServer_.FindTopDocuments(raw_query, status);
     AddRequest(docs.empty());
     return docs;
 }
 
 std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query) {
-    const auto docs = searchServer_.FindTopDocuments(raw_query);
+    const auto docs = resultCache_ != nullptr
+        ? resultCache_->FindTopDocuments(raw_query)
+        : searchServer_.FindTopDocuments(raw_query);
     AddRequest(docs.empty());
     return docs;
 }
@@ -1,12 +1,15 @@
 #pragma once
 
 #include "search_server.h"
+#include "result_cache.h"
 #include <vector>
 #include <deque>
 
 class RequestQueue {
 public:
     explicit RequestQueue(const SearchServer& search_server);
+    // Requests by status are answered through the cache, requests with a predicate go to its server
+    explicit RequestQueue(ResultCache& result_cache);
 
     template <typename DocumentPredicate>
     std::vector<Document> AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate);
@@ -24,6 +27,7 @@ private:
     std::deque<QueryResult> requests_;
     const static int min_in_day_ = 1440;
     const SearchServer& searchServer_;
+    ResultCache* resultCache_ = nullptr;
     int time_;
 
     void AddRequest(bool empty);
@@ -0,0 +1,74 @@
+#include "result_cache.h"
+
+ResultCache::ResultCache(const SearchServer& search_server, size_t capacity)
+    : search_server_(search_server)
+    , capacity_(capacity) {
+}
+
+std::vector<Document> ResultCache::FindTopDocuments(std::string_view raw_query, DocumentStatus status,
+    size_t max_result_count) {
+    const uint64_t generation = search_server_.GetGeneration();
+    const PreparedQuery query = search_server_.PrepareQuery(raw_query);
+    std::string key = MakeKey(query, "s" + std::to_string(static_cast<int>(status)), max_result_count);
+    if (auto documents = Find(key, generation)) {
+        return std::move(*documents);
+    }
+    auto documents = search_server_.FindTopDocuments(query, status, max_result_count);
+    Store(std::move(key), generation, documents);
+    return documents;
+}
+
+ResultCacheMetrics ResultCache::GetMetrics() const {
+    std::lock_guard guard(mutex_);
+    return metrics_;
+}
+
+std::string ResultCache::MakeKey(const PreparedQuery& query, std::string_view predicate_key, size_t max_result_count) {
+    // words have no control characters, so these separators cannot be mistaken for a part of a word
+    std::string key(predicate_key);
+    key += '\x1f';
+    key += std::to_string(max_result_count);
+    for (const std::string& word : query.GetPlusWords()) {
+        key += '\x1f';
+        key += word;
+    }
+    key += '\x1e';
+    for (const std::string& word : query.GetMinusWords()) {
+        key += '\x1f';
+        key += word;
+    }
+    return key;
+}
+
+std::optional<std::vector<Document>> ResultCache::Find(const std::string& key, uint64_t generation) {
+    std::lock_guard guard(mutex_);
+    if (generation != generation_) {
+        metrics_.invalidation_count += entries_.size();
+        entry_index_.clear();
+        entries_.clear();
+        generation_ = generation;
+    }
+    const auto iter = entry_index_.find(key);
+    if (iter == entry_index_.end()) {
+        ++metrics_.miss_count;
+        return std::nullopt;
+    }
+    ++metrics_.hit_count;
+    entries_.splice(entries_.begin(), entries_, iter->second);
+    return iter->second->documents;
+}
+
+void ResultCache::Store(std::string key, uint64_t generation, const std::vector<Document>& documents) {
+    std::lock_guard guard(mutex_);
+    // another thread may have stored the same result meanwhile
+    if (capacity_ == 0 || generation != generation_ || entry_index_.count(key) > 0) {
+        return;
+    }
+    if (entries_.size() == capacity_) {
+        entry_index_.erase(entries_.back().key);
+        entries_.pop_back();
+        ++metrics_.eviction_count;
+    }
+    entries_.push_front({ std::move(key), documents });
+    entry_index_.emplace(entries_.front().key, entries_.begin());
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "document.h"
+#include "search_server.h"
+
+struct ResultCacheMetrics {
+    size_t hit_count = 0;
+    size_t miss_count = 0;
+    // results dropped to make room for new ones
+    size_t eviction_count = 0;
+    // results dropped because the server has changed
+    size_t invalidation_count = 0;
+};
+
+// Results of FindTopDocuments on one server, keyed by the normalized query, the filter and the number of documents.
+// Queries differing only in the order or repetition of words or in stop words share a result.
+// All the results are dropped as soon as documents are added to the server or removed from it;
+// when the cache is full, the result that has not been asked for the longest time is dropped.
+// The cache may be shared by threads running queries on the server
+class ResultCache {
+public:
+    ResultCache(const SearchServer& search_server, size_t capacity);
+
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status = DocumentStatus::ACTUAL,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT);
+
+    // A predicate cannot be compared with another one, so it comes with a key:
+    // the same key has to mean the same predicate for as long as the cache lives
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, std::string_view predicate_key,
+        DocumentPredicate document_predicate, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT);
+
+    ResultCacheMetrics GetMetrics() const;
+
+    const SearchServer& GetSearchServer() const {
+        return search_server_;
+    }
+
+private:
+    struct Entry {
+        std::string key;
+        std::vector<Document> documents;
+    };
+
+    const SearchServer& search_server_;
+    size_t capacity_;
+    // generation of the server the cached results belong to
+    uint64_t generation_ = 0;
+    // from the most to the least recently used
+    std::list<Entry> entries_;
+    // keys refer to the keys in entries_
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> entry_index_;
+    ResultCacheMetrics metrics_;
+    mutable std::mutex mutex_;
+
+    static std::string MakeKey(const PreparedQuery& query, std::string_view predicate_key, size_t max_result_count);
+
+    std::optional<std::vector<Document>> Find(const std::string& key, uint64_t generation);
+
+    void Store(std::string key, uint64_t generation, const std::vector<Document>& documents);
+};
+
+template <typename DocumentPredicate>
+std::vector<Document> ResultCache::FindTopDocuments(std::string_view raw_query, std::string_view predicate_key,
+    DocumentPredicate document_predicate, size_t max_result_count) {
+    const uint64_t generation = search_server_.GetGeneration();
+    const PreparedQuery query = search_server_.PrepareQuery(raw_query);
+    // user keys and the keys of statuses start differently, so they never clash
+    std::string key = MakeKey(query, "p" + std::string(predicate_key), max_result_count);
+    if (auto documents = Find(key, generation)) {
+        return std::move(*documents);
+    }
+    auto documents = search_server_.FindTopDocuments(query, document_predicate, max_result_count);
+    Store(std::move(key), generation, documents);
+    return documents;
+}
@@ -1,7 +1,9 @@
 #include "search_server.h"
 #include "string_processing.h"
 #include <algorithm>
+#include <atomic>
 #include <math.h>
+#include <unordered_set>
 
 SearchServer::SearchServer(const std::string& stop_words_text) :
     SearchServer(std::string_view(stop_words_text)) {
@@ -11,28 +13,282 @@ SearchServer::SearchServer(std::string_view str) :
     SearchServer(SplitIntoWords(str)) {
 }
 
+SearchServer::SearchServer(const SearchServer& other) :
+    stop_words_(other.stop_words_),
+    shards_(other.shards_),
+    document_shards_(other.document_shards_),
+    dictionary_(other.dictionary_),
+    query_evaluation_(other.query_evaluation_),
+    executor_(other.executor_),
+    document_ids_(other.document_ids_),
+    document_term_freqs_(other.document_term_freqs_),
+    words_ids_(other.words_ids_),
+    snapshot_file_(other.snapshot_file_),
+    query_profiler_(other.query_profiler_) {
+    // texts left in the snapshot stay there, the file is shared
+    document_texts_.reserve(other.document_texts_.size());
+    for (const auto& [document_id, text] : other.document_texts_) {
+        document_texts_.emplace(document_id, other.document_text_arena_.Owns(text) ? document_text_arena_.Store(text) : text);
+    }
+}
+
+SearchServer& SearchServer::operator=(const SearchServer& other) {
+    if (this != &other) {
+        *this = SearchServer(other);
+    }
+    return *this;
+}
+
 //  
 void SearchServer::AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings) {
+    CheckNewDocumentId(document_id);
+    const ParsedDocument parsed_document = ParseDocument(document);
+    // the index keeps its own copies of the words, the text can go away independently
+    auto& term_freqs = document_term_freqs_[document_id];
+    term_freqs = AcquireTerms(parsed_document);
+    const size_t shard_index = ChooseShard();
+    shards_[shard_index].AddDocument(document_id, status, ComputeAverageRating(ratings), parsed_document.word_count, term_freqs);
+    document_shards_.emplace(document_id, shard_index);
+    document_ids_.push_back(document_id);
+    document_texts_.emplace(document_id, document_text_arena_.Store(document));
+    generation_ = NextGeneration();
+}
+
+void SearchServer::AddDocuments(const std::vector<NewDocument>& documents) {
     using namespace std;
-    if ((document_id < 0) || (documents_.count(document_id) > 0)) {
+    vector<int> new_ids;
+    new_ids.reserve(documents.size());
+    for (const NewDocument& document : documents) {
+        CheckNewDocumentId(document.id);
+        new_ids.push_back(document.id);
+    }
+    sort(new_ids.begin(), new_ids.end());
+    if (adjacent_find(new_ids.begin(), new_ids.end()) != new_ids.end()) {
         throw invalid_argument("Invalid document_id"s);
     }
-    all_docs_.emplace_back(document);
-    const auto words = SplitIntoWordsNoStop(all_docs_.back());
-    //const auto words = SplitIntoWordsNoStop(document);
-    const double inv_word_count = 1.0 / words.size();
-    for (const auto &word : words) {
-        word_to_document_freqs_[word][document_id] += inv_word_count;
-        document_to_word_freqs_[document_id][word] += inv_word_count;
+
+    // Tokenizing reads nothing but the stop words; an invalid word is rethrown before anything changes
+    vector<ParsedDocument> parsed_documents(documents.size());
+    executor_->ParallelFor(documents.size(), [this, &documents, &parsed_documents](size_t i) {
+        parsed_documents[i] = ParseDocument(documents[i].text);
+    });
+
+    vector<vector<TermFreq>> batch_terms = AcquireTerms(parsed_documents);
+
+    // Every shard gets as many documents as adding them one by one to the least filled shard would give it,
+    // as one contiguous part of the batch
+    vector<size_t> shard_document_counts(shards_.size());
+    for (size_t shard_index = 0; shard_index < shards_.size(); ++shard_index) {
+        shard_document_counts[shard_index] = shards_[shard_index].GetDocumentCount();
     }
-    documents_.emplace(document_id, DocumentData{ ComputeAverageRating(ratings), status });
-    document_ids_.push_back(document_id);
+    vector<size_t> shard_ends(shards_.size());
+    {
+        vector<size_t> levels = shard_document_counts;
+        sort(levels.begin(), levels.end());
+        // the level every shard is filled up to, and the number of shards that get one document more
+        size_t remaining = documents.size();
+        size_t filled_count = 1;
+        size_t level = levels[0];
+        while (remaining > 0) {
+            while (filled_count < levels.size() && levels[filled_count] == level) {
+                ++filled_count;
+            }
+            const size_t next_level = filled_count < levels.size() ? levels[filled_count] : SIZE_MAX;
+            const size_t step = min(next_level - level, remaining / filled_count);
+            if (step == 0) {
+                break;
+            }
+            level += step;
+            remaining -= step * filled_count;
+        }
+        size_t end = 0;
+        for (size_t shard_index = 0; shard_index < shards_.size(); ++shard_index) {
+            size_t count = shard_document_counts[shard_index] < level ? level - shard_document_counts[shard_index] : 0;
+            // the leftover documents go to the first shards at the level, as min_element would pick them
+            if (remaining > 0 && shard_document_counts[shard_index] <= level) {
+                ++count;
+                --remaining;
+            }
+            end += count;
+            shard_ends[shard_index] = end;
+        }
+    }
+
+    document_term_freqs_.reserve(document_term_freqs_.size() + documents.size());
+    document_shards_.reserve(document_shards_.size() + documents.size());
+    document_texts_.reserve(document_texts_.size() + documents.size());
+    document_ids_.reserve(document_ids_.size() + documents.size());
+    vector<const SnapshotArray<TermFreq>*> batch_term_freqs(documents.size());
+    size_t shard_index = 0;
+    for (size_t i = 0; i < documents.size(); ++i) {
+        const int document_id = documents[i].id;
+        auto& term_freqs = document_term_freqs_[document_id];
+        term_freqs = move(batch_terms[i]);
+        batch_term_freqs[i] = &term_freqs;
+        while (shard_ends[shard_index] == i) {
+            ++shard_index;
+        }
+        document_shards_.emplace(document_id, shard_index);
+        document_ids_.push_back(document_id);
+        document_texts_.emplace(document_id, document_text_arena_.Store(documents[i].text));
+    }
+
+    // Shards share nothing, each one appends its documents to its own posting lists
+    executor_->ParallelFor(shards_.size(), [&](size_t shard_index) {
+        for (size_t i = shard_index == 0 ? 0 : shard_ends[shard_index - 1]; i < shard_ends[shard_index]; ++i) {
+            const NewDocument& document = documents[i];
+            shards_[shard_index].AddDocument(document.id, document.status, ComputeAverageRating(document.ratings),
+                parsed_documents[i].word_count, *batch_term_freqs[i]);
+        }
+    });
+    generation_ = NextGeneration();
+}
+
+void SearchServer::SetQueryEvaluation(QueryEvaluation query_evaluation) {
+    query_evaluation_ = query_evaluation;
+}
+
+void SearchServer::SetQueryProfiler(std::shared_ptr<QueryProfiler> query_profiler) {
+    query_profiler_ = std::move(query_profiler);
+}
+
+void SearchServer::SaveSnapshot(const std::string& path) const {
+    SnapshotWriter writer(path);
+    writer.Write(SNAPSHOT_MAGIC);
+    writer.Write(SNAPSHOT_VERSION);
+    writer.Write<uint64_t>(stop_words_.size());
+    for (const std::string& stop_word : stop_words_) {
+        writer.WriteString(stop_word);
+    }
+
+    dictionary_.Save(writer);
+
+    writer.Write<uint64_t>(document_ids_.size());
+    for (const int document_id : document_ids_) {
+        writer.Write(document_id);
+        writer.Write<uint64_t>(document_shards_.at(document_id));
+        writer.WriteString(document_texts_.at(document_id));
+        writer.WriteArray(document_term_freqs_.at(document_id));
+    }
+
+    writer.Write<uint64_t>(shards_.size());
+    for (const IndexShard& shard : shards_) {
+        shard.Save(writer);
+    }
+    writer.Finish();
+}
+
+SearchServer SearchServer::LoadSnapshot(const std::string& path) {
+    using namespace std;
+    auto file = make_shared<const MappedFile>(path);
+    SnapshotReader reader(file->GetData());
+    if (reader.Read<uint64_t>() != SNAPSHOT_MAGIC) {
+        throw runtime_error(path + " is not a search server snapshot"s);
+    }
+    if (reader.Read<uint32_t>() != SNAPSHOT_VERSION) {
+        throw runtime_error("Unsupported snapshot version in "s + path);
+    }
+    vector<string_view> stop_words(reader.ReadSize(sizeof(uint64_t)));
+    for (auto& stop_word : stop_words) {
+        stop_word = reader.ReadString();
+    }
+    SearchServer search_server(stop_words);
+    search_server.snapshot_file_ = file;
+
+    search_server.dictionary_.Load(reader);
+
+    // Everything read is checked before anything indexes with it: ids, shard indices and term ids
+    const uint32_t term_id_count = static_cast<uint32_t>(search_server.dictionary_.GetTermIdCount());
+    // a document takes at least its id, its shard and the sizes of its text and terms
+    const size_t document_count = reader.ReadSize(sizeof(int) + 3 * sizeof(uint64_t));
+    search_server.document_ids_.reserve(document_count);
+    search_server.document_shards_.reserve(document_count);
+    search_server.document_texts_.reserve(document_count);
+    search_server.document_term_freqs_.reserve(document_count);
+    for (size_t i = 0; i < document_count; ++i) {
+        const int document_id = reader.Read<int>();
+        if (document_id < 0 || !search_server.document_shards_.emplace(document_id, reader.Read<uint64_t>()).second) {
+            SnapshotReader::ThrowCorrupted();
+        }
+        search_server.document_texts_.emplace(document_id, reader.ReadString());
+        auto& term_freqs = search_server.document_term_freqs_[document_id];
+        reader.ReadArray(term_freqs);
+        for (size_t j = 0; j < term_freqs.size(); ++j) {
+            if (term_freqs[j].term_id >= term_id_count || search_server.dictionary_.GetDocumentCount(term_freqs[j].term_id) <= 0
+                || (j > 0 && term_freqs[j - 1].term_id >= term_freqs[j].term_id)) {
+                SnapshotReader::ThrowCorrupted();
+            }
+        }
+        search_server.document_ids_.push_back(document_id);
+    }
+
+    // a server always has a shard to add documents to
+    const size_t shard_count = reader.ReadSize(sizeof(uint64_t));
+    if (shard_count == 0) {
+        SnapshotReader::ThrowCorrupted();
+    }
+    search_server.shards_ = vector<IndexShard>(shard_count);
+    vector<int> shard_document_counts(search_server.shards_.size());
+    for (const auto& [document_id, shard_index] : search_server.document_shards_) {
+        if (shard_index >= shard_document_counts.size()) {
+            SnapshotReader::ThrowCorrupted();
+        }
+        ++shard_document_counts[shard_index];
+    }
+    for (size_t shard_index = 0; shard_index < search_server.shards_.size(); ++shard_index) {
+        search_server.shards_[shard_index].Load(reader);
+        if (search_server.shards_[shard_index].GetDocumentCount() != shard_document_counts[shard_index]) {
+            SnapshotReader::ThrowCorrupted();
+        }
+    }
+    return search_server;
 }
 
-std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentStatus status) const {
+void SearchServer::SetShardCount(size_t shard_count) {
+    std::vector<IndexShard> old_shards(std::max<size_t>(1, shard_count));
+    std::swap(shards_, old_shards);
+    for (const int document_id : document_ids_) {
+        const IndexShard& old_shard = old_shards[document_shards_.at(document_id)];
+        const size_t shard_index = ChooseShard();
+        shards_[shard_index].AddDocument(document_id, old_shard.GetStatus(document_id), old_shard.GetRating(document_id),
+            old_shard.GetWordCount(document_id), document_term_freqs_.at(document_id));
+        document_shards_[document_id] = shard_index;
+    }
+}
+
+size_t SearchServer::GetPostingCount() const {
+    size_t posting_count = 0;
+    for (const IndexShard& shard : shards_) {
+        posting_count += shard.GetPostingCount();
+    }
+    return posting_count;
+}
+
+size_t SearchServer::GetPostingByteSize() const {
+    size_t byte_size = 0;
+    for (const IndexShard& shard : shards_) {
+        byte_size += shard.GetPostingByteSize();
+    }
+    return byte_size;
+}
+
+void SearchServer::SetWorkerCount(size_t worker_count) {
+    executor_ = std::make_shared<ThreadPool>(worker_count);
+}
+
+std::vector<std::vector<Document>> SearchServer::FindTopDocumentsBatch(const std::vector<std::string_view>& raw_queries) const {
+    std::vector<std::vector<Document>> documents_lists(raw_queries.size());
+    executor_->ParallelFor(raw_queries.size(), [this, &raw_queries, &documents_lists](size_t i) {
+        documents_lists[i] = FindTopDocuments(raw_queries[i]);
+    });
+    return documents_lists;
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentStatus status,
+    size_t max_result_count) const {
     return FindTopDocuments(raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
         return document_status == status;
-        });
+        }, max_result_count);
 }
 
 std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query) const {
@@ -40,8 +296,8 @@ std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query)
 }
 
 std::vector<Document> SearchServer::FindTopDocuments(const std::execution::sequenced_policy& policy,
-    std::string_view raw_query, DocumentStatus status) const {
-    return FindTopDocuments(raw_query, status);
+    std::string_view raw_query, DocumentStatus status, size_t max_result_count) const {
+    return FindTopDocuments(raw_query, status, max_result_count);
 }
 
 std::vector<Document> SearchServer::FindTopDocuments(const std::execution::sequenced_policy& policy,
@@ -50,10 +306,10 @@ std::vector<Document> SearchServer::FindTopDocuments(const std::execution::seque
 }
 
 std::vector<Document> SearchServer::FindTopDocuments(const std::execution::parallel_policy& policy,
-    std::string_view raw_query, DocumentStatus status) const {
+    std::string_view raw_query, DocumentStatus status, size_t max_result_count) const {
     return FindTopDocuments(policy, raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
         return document_status == status;
-        });
+        }, max_result_count);
 }
 
 std::vector<Document> SearchServer::FindTopDocuments(const std::execution::parallel_policy& policy,
@@ -61,41 +317,87 @@ std::vector<Document> SearchServer::FindTopDocuments(const std::execution::paral
     return FindTopDocuments(policy, raw_query, DocumentStatus::ACTUAL);
 }
 
+PreparedQuery SearchServer::PrepareQuery(std::string_view raw_query) const {
+    const auto query = ParseQuery(raw_query);
+    const auto to_sorted_words = [](std::vector<std::string_view> words) {
+        std::sort(words.begin(), words.end());
+        words.erase(std::unique(words.begin(), words.end()), words.end());
+        return std::vector<std::string>(words.begin(), words.end());
+    };
+    PreparedQuery prepared_query;
+    prepared_query.plus_words_ = to_sorted_words(query.plus_words);
+    prepared_query.minus_words_ = to_sorted_words(query.minus_words);
+    prepared_query.terms_ = ResolveTerms(prepared_query.plus_words_, prepared_query.minus_words_);
+    prepared_query.generation_ = generation_;
+    return prepared_query;
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(const PreparedQuery& query, DocumentStatus status,
+    size_t max_result_count) const {
+    return FindTopDocuments(query, [status](int document_id, DocumentStatus document_status, int rating) {
+        return document_status == status;
+        }, max_result_count);
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(const PreparedQuery& query) const {
+    return FindTopDocuments(query, DocumentStatus::ACTUAL);
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(const std::execution::sequenced_policy& policy,
+    const PreparedQuery& query, DocumentStatus status, size_t max_result_count) const {
+    return FindTopDocuments(query, status, max_result_count);
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(const std::execution::sequenced_policy& policy,
+    const PreparedQuery& query) const {
+    return FindTopDocuments(query);
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(const std::execution::parallel_policy& policy,
+    const PreparedQuery& query, DocumentStatus status, size_t max_result_count) const {
+    return FindTopDocuments(policy, query, [status](int document_id, DocumentStatus document_status, int rating) {
+        return document_status == status;
+        }, max_result_count);
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(const std::execution::parallel_policy& policy,
+    const PreparedQuery& query) const {
+    return FindTopDocuments(policy, query, DocumentStatus::ACTUAL);
+}
 
 int SearchServer::GetDocumentCount() const {
-    return static_cast<int>(documents_.size());
+    return static_cast<int>(document_shards_.size());
+}
+
+ArenaMemoryUsage SearchServer::GetTextMemoryUsage() const {
+    return document_text_arena_.GetMemoryUsage();
+}
+
+ArenaMemoryUsage SearchServer::GetWordMemoryUsage() const {
+    return dictionary_.GetMemoryUsage();
 }
 
 std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(std::string_view raw_query, int document_id) const {
     auto query = ParseQuery(raw_query);
-    std::sort(query.minus_words.begin(), query.minus_words.end());
-    const auto minus_word = std::unique(query.minus_words.begin(), query.minus_words.end());
-    query.minus_words.erase(minus_word, query.minus_words.end());
-    std::sort(query.plus_words.begin(), query.plus_words.end());
-    const auto plus_word = std::unique(query.plus_words.begin(), query.plus_words.end());
-    query.plus_words.erase(plus_word, query.plus_words.end());
-
+    const SnapshotArray<TermFreq>& term_freqs = document_term_freqs_.at(document_id);
+    const DocumentStatus status = GetShard(document_id).GetStatus(document_id);
     std::vector<std::string_view> matched_words;
+    // one minus word settles the match, the plus words are not even sorted then
     for (const auto& word : query.minus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        if (word_to_document_freqs_.at(word).count(document_id)) {
-            matched_words.clear();
-            return { matched_words, documents_.at(document_id).status };
+        if (HasDocumentWord(term_freqs, word)) {
+            return { matched_words, status };
         }
     }
 
+    std::sort(query.plus_words.begin(), query.plus_words.end());
+    const auto plus_word = std::unique(query.plus_words.begin(), query.plus_words.end());
+    query.plus_words.erase(plus_word, query.plus_words.end());
     for (const auto& word : query.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        if (word_to_document_freqs_.at(word).count(document_id)) {
+        if (HasDocumentWord(term_freqs, word)) {
             matched_words.push_back(word);
         }
     }
-
-    return { matched_words, documents_.at(document_id).status };
+    return { matched_words, status };
 }
 
 std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::execution::sequenced_policy& policy,
@@ -105,30 +407,186 @@ std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDoc
 
 std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::execution::parallel_policy& policy,
     std::string_view raw_query, int document_id) const {
-    const auto& query = ParseQuery(raw_query);
+    // A word costs a hash lookup and a binary search over the terms of one document, far less
+    // than handing it to another thread, so a single document is matched on the calling thread.
+    // MatchDocuments runs many documents in parallel
+    return MatchDocument(raw_query, document_id);
+}
 
-    std::vector<std::string_view> matched_words;
-    if (std::any_of(policy, query.minus_words.begin(), query.minus_words.end(),
-        [&](const auto& word) {
-            return (word_to_document_freqs_.count(word) && word_to_document_freqs_.at(word).count(document_id));
-        })) {
-        matched_words.clear();
-        return { matched_words, documents_.at(document_id).status };
-    }
-    matched_words.resize(query.plus_words.size());
-    auto it = std::copy_if(policy, query.plus_words.begin(),
-        query.plus_words.end(), matched_words.begin(),
-        [&](auto word) {
-            return (word_to_document_freqs_.count(word) && word_to_document_freqs_.at(word).count(document_id));
+SearchServer::ParsedDocument SearchServer::ParseDocument(std::string_view text) const {
+    ParsedDocument document;
+    auto words = SplitIntoWordsNoStop(text);
+    document.word_count = static_cast<int>(words.size());
+    const double inv_word_count = 1.0 / words.size();
+    std::sort(words.begin(), words.end());
+    for (const auto& word : words) {
+        if (document.word_freqs.empty() || document.word_freqs.back().first != word) {
+            document.word_freqs.emplace_back(word, 0.0);
+        }
+        document.word_freqs.back().second += inv_word_count;
+    }
+    return document;
+}
+
+std::vector<TermFreq> SearchServer::AcquireTerms(const ParsedDocument& document) {
+    std::vector<TermFreq> term_freqs;
+    term_freqs.reserve(document.word_freqs.size());
+    for (const auto& [word, term_freq] : document.word_freqs) {
+        term_freqs.push_back({ dictionary_.Acquire(word), term_freq });
+    }
+    std::sort(term_freqs.begin(), term_freqs.end(), [](const TermFreq& lhs, const TermFreq& rhs) {
+        return lhs.term_id < rhs.term_id;
+    });
+    return term_freqs;
+}
+
+std::vector<std::vector<TermFreq>> SearchServer::AcquireTerms(const std::vector<ParsedDocument>& documents) {
+    using namespace std;
+    struct BatchTerm {
+        string_view word;
+        size_t hash;
+        // position of the first use in the batch: single additions give ids in this order
+        size_t first_use;
+        int document_count;
+        uint32_t term_id;
+    };
+    // hash of every word of every document, then the index of its term in the partition
+    struct TermRef {
+        size_t hash;
+        uint32_t index;
+    };
+    const size_t partition_count = executor_->GetWorkerCount();
+    vector<size_t> word_offsets(documents.size() + 1);
+    for (size_t i = 0; i < documents.size(); ++i) {
+        word_offsets[i + 1] = word_offsets[i] + documents[i].word_freqs.size();
+    }
+    // the refs of the i-th document start at word_offsets[i]
+    vector<TermRef> term_refs(word_offsets.back());
+    executor_->ParallelFor(documents.size(), [&](size_t i) {
+        for (size_t j = 0; j < documents[i].word_freqs.size(); ++j) {
+            term_refs[word_offsets[i] + j].hash = hash<string_view>{}(documents[i].word_freqs[j].first);
+        }
+    });
+
+    // Words of different partitions never meet, so the partitions are deduplicated independently,
+    // each one in a linear-probing table of term indexes plus one, grown at half full
+    vector<vector<BatchTerm>> partition_terms(partition_count);
+    executor_->ParallelFor(partition_count, [&](size_t partition) {
+        auto& terms = partition_terms[partition];
+        vector<uint32_t> slots(1024);
+        auto find_slot = [&](size_t word_hash, string_view word) {
+            size_t slot = (word_hash / partition_count) & (slots.size() - 1);
+            while (slots[slot] != 0 && terms[slots[slot] - 1].word != word) {
+                slot = (slot + 1) & (slots.size() - 1);
+            }
+            return slot;
+        };
+        for (size_t i = 0; i < documents.size(); ++i) {
+            for (size_t j = 0; j < documents[i].word_freqs.size(); ++j) {
+                TermRef& term_ref = term_refs[word_offsets[i] + j];
+                if (term_ref.hash % partition_count != partition) {
+                    continue;
+                }
+                const string_view word = documents[i].word_freqs[j].first;
+                size_t slot = find_slot(term_ref.hash, word);
+                if (slots[slot] == 0) {
+                    if ((terms.size() + 1) * 2 > slots.size()) {
+                        slots.assign(slots.size() * 2, 0);
+                        for (size_t k = 0; k < terms.size(); ++k) {
+                            slots[find_slot(terms[k].hash, terms[k].word)] = static_cast<uint32_t>(k + 1);
+                        }
+                        slot = find_slot(term_ref.hash, word);
+                    }
+                    terms.push_back({ word, term_ref.hash, word_offsets[i] + j, 0, TermDictionary::NO_TERM });
+                    slots[slot] = static_cast<uint32_t>(terms.size());
+                }
+                ++terms[slots[slot] - 1].document_count;
+                term_ref.index = slots[slot] - 1;
+            }
+        }
+    });
+
+    // The only serial step: one dictionary lookup per distinct word
+    vector<BatchTerm*> batch_terms;
+    for (auto& terms : partition_terms) {
+        for (BatchTerm& term : terms) {
+            batch_terms.push_back(&term);
+        }
+    }
+    sort(batch_terms.begin(), batch_terms.end(), [](const BatchTerm* lhs, const BatchTerm* rhs) {
+        return lhs->first_use < rhs->first_use;
+    });
+    for (BatchTerm* term : batch_terms) {
+        term->term_id = dictionary_.Acquire(term->word, term->document_count);
+    }
+
+    vector<vector<TermFreq>> term_freqs(documents.size());
+    executor_->ParallelFor(documents.size(), [&](size_t i) {
+        term_freqs[i].reserve(documents[i].word_freqs.size());
+        for (size_t j = 0; j < documents[i].word_freqs.size(); ++j) {
+            const TermRef& term_ref = term_refs[word_offsets[i] + j];
+            term_freqs[i].push_back({ partition_terms[term_ref.hash % partition_count][term_ref.index].term_id,
+                documents[i].word_freqs[j].second });
         }
-    );
-    matched_words.erase(it, matched_words.end());
+        sort(term_freqs[i].begin(), term_freqs[i].end(), [](const TermFreq& lhs, const TermFreq& rhs) {
+            return lhs.term_id < rhs.term_id;
+        });
+    });
+    return term_freqs;
+}
+
+void SearchServer::CheckNewDocumentId(int document_id) const {
+    using namespace std;
+    if ((document_id < 0) || (document_shards_.count(document_id) > 0)) {
+        throw invalid_argument("Invalid document_id"s);
+    }
+}
 
-    std::sort(matched_words.begin(), matched_words.end());
-    const auto doc = std::unique(matched_words.begin(), matched_words.end());
-    matched_words.erase(doc, matched_words.end());
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const PreparedQuery& query,
+    int document_id) const {
+    std::tuple<std::vector<std::string_view>, DocumentStatus> result;
+    MatchDocumentTerms(GetMatchTerms(query), document_id, result);
+    return result;
+}
 
-    return { matched_words, documents_.at(document_id).status };
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::execution::sequenced_policy& policy,
+    const PreparedQuery& query, int document_id) const {
+    return MatchDocument(query, document_id);
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::execution::parallel_policy& policy,
+    const PreparedQuery& query, int document_id) const {
+    return MatchDocument(query, document_id);
+}
+
+void SearchServer::MatchDocuments(std::string_view raw_query, const std::vector<int>& document_ids,
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>>& results) const {
+    MatchAllDocuments(std::execution::seq, GetMatchTerms(raw_query), document_ids, results);
+}
+
+void SearchServer::MatchDocuments(const std::execution::sequenced_policy& policy, std::string_view raw_query,
+    const std::vector<int>& document_ids, std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>>& results) const {
+    MatchAllDocuments(policy, GetMatchTerms(raw_query), document_ids, results);
+}
+
+void SearchServer::MatchDocuments(const std::execution::parallel_policy& policy, std::string_view raw_query,
+    const std::vector<int>& document_ids, std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>>& results) const {
+    MatchAllDocuments(policy, GetMatchTerms(raw_query), document_ids, results);
+}
+
+void SearchServer::MatchDocuments(const PreparedQuery& query, const std::vector<int>& document_ids,
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>>& results) const {
+    MatchAllDocuments(std::execution::seq, GetMatchTerms(query), document_ids, results);
+}
+
+void SearchServer::MatchDocuments(const std::execution::sequenced_policy& policy, const PreparedQuery& query,
+    const std::vector<int>& document_ids, std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>>& results) const {
+    MatchAllDocuments(policy, GetMatchTerms(query), document_ids, results);
+}
+
+void SearchServer::MatchDocuments(const std::execution::parallel_policy& policy, const PreparedQuery& query,
+    const std::vector<int>& document_ids, std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>>& results) const {
+    MatchAllDocuments(policy, GetMatchTerms(query), document_ids, results);
 }
 
 bool SearchServer::IsStopWord(std::string_view word) const {
@@ -137,16 +595,16 @@ bool SearchServer::IsStopWord(std::string_view word) const {
 
 bool SearchServer::IsValidWord(std::string_view word) {
     // A valid word must not contain special characters
-    return none_of(word.begin(), word.end(), [](char c) {
-        return c >= '\0' && c < ' ';
-        });
+    return !HasControlCharacters(word);
 }
 
 std::vector<std::string_view> SearchServer::SplitIntoWordsNoStop(std::string_view text) const {
     using namespace std;
     std::vector<std::string_view> words;
-   for (const auto &word : SplitIntoWords(text)) {
-        if (!IsValidWord(word)) {
+    // only spaces between the words are left out of them, so one scan of the text checks all the words
+    const bool has_invalid_words = HasControlCharacters(text);
+    for (const auto &word : SplitIntoWords(text)) {
+        if (has_invalid_words && !IsValidWord(word)) {
             throw invalid_argument("Word "s + word.data() + " is invalid"s);
         }
         if (!IsStopWord(word)) {
@@ -197,22 +655,161 @@ SearchServer::Query SearchServer::ParseQuery(std::string_view text) const {
     return result;
 }
 
-double SearchServer::ComputeWordInverseDocumentFreq(std::string_view word) const {
-    return log(GetDocumentCount() * 1.0 / word_to_document_freqs_.at(word).size());
+double SearchServer::ComputeInverseDocumentFreq(int word_document_count) const {
+    return log(GetDocumentCount() * 1.0 / word_document_count);
 }
 
-void SearchServer::RemoveDocument(const int document_id) {
-    const auto& words = GetWordFrequencies(document_id);
-    for (auto &[word, freq] : words) {
-        auto iter = word_to_document_freqs_.at(word).find(document_id);
-        word_to_document_freqs_.at(word).erase(iter);
+PreparedQuery::Terms SearchServer::ResolveTerms(const std::vector<std::string>& plus_words,
+    const std::vector<std::string>& minus_words) const {
+    PreparedQuery::Terms terms;
+    for (const std::string& word : plus_words) {
+        const uint32_t term_id = dictionary_.Find(word);
+        terms.plus_word_terms.push_back(term_id);
+        if (term_id != TermDictionary::NO_TERM) {
+            terms.plus_terms.push_back({ term_id, ComputeInverseDocumentFreq(dictionary_.GetDocumentCount(term_id)) });
+        }
     }
-    document_to_word_freqs_.erase(document_id);
-    documents_.erase(document_id);
-    {
-        auto iter = find(document_ids_.begin(), document_ids_.end(), document_id);
-        document_ids_.erase(iter);
+    for (const std::string& word : minus_words) {
+        const uint32_t term_id = dictionary_.Find(word);
+        if (term_id != TermDictionary::NO_TERM) {
+            terms.minus_terms.push_back(term_id);
+        }
+    }
+    return terms;
+}
+
+const PreparedQuery::Terms& SearchServer::GetTerms(const PreparedQuery& query, PreparedQuery::Terms& fresh_terms) const {
+    if (query.generation_ == generation_) {
+        return query.terms_;
+    }
+    // term ids of removed words are given to new ones, and IDF changes with every document
+    fresh_terms = ResolveTerms(query.plus_words_, query.minus_words_);
+    return fresh_terms;
+}
+
+uint64_t SearchServer::NextGeneration() {
+    static std::atomic<uint64_t> next_generation{ 1 };
+    return next_generation.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool SearchServer::HasDocumentTerm(const SnapshotArray<TermFreq>& term_freqs, uint32_t term_id) {
+    // terms of a document are sorted by id
+    const auto iter = std::lower_bound(term_freqs.begin(), term_freqs.end(), term_id,
+        [](const TermFreq& term_freq, uint32_t term_id) {
+            return term_freq.term_id < term_id;
+        });
+    return iter != term_freqs.end() && iter->term_id == term_id;
+}
+
+bool SearchServer::HasDocumentWord(const SnapshotArray<TermFreq>& term_freqs, std::string_view word) const {
+    const uint32_t term_id = dictionary_.Find(word);
+    return term_id != TermDictionary::NO_TERM && HasDocumentTerm(term_freqs, term_id);
+}
+
+SearchServer::MatchTerms SearchServer::GetMatchTerms(std::string_view raw_query) const {
+    auto query = ParseQuery(raw_query);
+    std::sort(query.plus_words.begin(), query.plus_words.end());
+    query.plus_words.erase(std::unique(query.plus_words.begin(), query.plus_words.end()), query.plus_words.end());
+    MatchTerms terms;
+    for (const auto& word : query.plus_words) {
+        terms.plus_word_terms.push_back(dictionary_.Find(word));
+    }
+    terms.plus_words = std::move(query.plus_words);
+    for (const auto& word : query.minus_words) {
+        const uint32_t term_id = dictionary_.Find(word);
+        if (term_id != TermDictionary::NO_TERM) {
+            terms.minus_terms.push_back(term_id);
+        }
+    }
+    return terms;
+}
+
+SearchServer::MatchTerms SearchServer::GetMatchTerms(const PreparedQuery& query) const {
+    PreparedQuery::Terms fresh_terms;
+    const auto& query_terms = GetTerms(query, fresh_terms);
+    MatchTerms terms;
+    terms.plus_words.assign(query.plus_words_.begin(), query.plus_words_.end());
+    terms.plus_word_terms = query_terms.plus_word_terms;
+    terms.minus_terms = query_terms.minus_terms;
+    return terms;
+}
+
+void SearchServer::MatchDocumentTerms(const MatchTerms& terms, int document_id,
+    std::tuple<std::vector<std::string_view>, DocumentStatus>& result) const {
+    const SnapshotArray<TermFreq>& term_freqs = document_term_freqs_.at(document_id);
+    const auto has_term = [&term_freqs](uint32_t term_id) {
+        return HasDocumentTerm(term_freqs, term_id);
+    };
+    auto& [matched_words, status] = result;
+    matched_words.clear();
+    status = GetShard(document_id).GetStatus(document_id);
+    if (std::any_of(terms.minus_terms.begin(), terms.minus_terms.end(), has_term)) {
+        return;
+    }
+    for (size_t i = 0; i < terms.plus_words.size(); ++i) {
+        if (terms.plus_word_terms[i] != TermDictionary::NO_TERM && has_term(terms.plus_word_terms[i])) {
+            matched_words.push_back(terms.plus_words[i]);
+        }
+    }
+}
+
+void SearchServer::RecordQuery(std::string_view raw_query, const PreparedQuery& query, const QueryStats& stats) const {
+    // the text of a prepared query is only put together if it is kept among the slow ones
+    if (!raw_query.empty() || !query_profiler_->IsSlow(stats)) {
+        query_profiler_->Record(raw_query, stats);
+        return;
     }
+    std::string text;
+    for (const std::string& word : query.GetPlusWords()) {
+        text += text.empty() ? "" : " ";
+        text += word;
+    }
+    for (const std::string& word : query.GetMinusWords()) {
+        text += text.empty() ? "-" : " -";
+        text += word;
+    }
+    query_profiler_->Record(text, stats);
+}
+
+const IndexShard& SearchServer::GetShard(int document_id) const {
+    return shards_[document_shards_.at(document_id)];
+}
+
+size_t SearchServer::ChooseShard() const {
+    const auto iter = std::min_element(shards_.begin(), shards_.end(), [](const IndexShard& lhs, const IndexShard& rhs) {
+        return lhs.GetDocumentCount() < rhs.GetDocumentCount();
+    });
+    return iter - shards_.begin();
+}
+
+void SearchServer::ReleaseDocumentText(int document_id) {
+    const auto text_iter = document_texts_.find(document_id);
+    document_text_arena_.Release(text_iter->second);
+    document_texts_.erase(text_iter);
+    // Chunks are freed only when all their texts are gone; once most of the memory is taken
+    // by removed texts, the rest are moved to new chunks
+    const auto usage = document_text_arena_.GetMemoryUsage();
+    if (usage.chunk_count > 1 && usage.live_bytes * 2 < usage.allocated_bytes) {
+        TextArena compacted_arena;
+        for (auto& [id, text] : document_texts_) {
+            if (document_text_arena_.Owns(text)) {
+                text = compacted_arena.Store(text);
+            }
+        }
+        document_text_arena_ = std::move(compacted_arena);
+    }
+}
+
+void SearchServer::RemoveDocument(const int document_id) {
+    const auto shard_iter = document_shards_.find(document_id);
+    if (shard_iter == document_shards_.end()) {
+        return;
+    }
+    IndexShard& shard = shards_[shard_iter->second];
+    EraseDocument(document_id);
+    document_ids_.erase(std::find(document_ids_.begin(), document_ids_.end(), document_id));
+    shard.CompactSegments();
+    generation_ = NextGeneration();
 }
 
 void SearchServer::RemoveDocument(const std::execution::sequenced_policy& policy, const int document_id) {
@@ -220,36 +817,73 @@ void SearchServer::RemoveDocument(const std::execution::sequenced_policy& policy
 }
 
 void SearchServer::RemoveDocument(const std::execution::parallel_policy& policy, const int document_id) {
-   if (document_to_word_freqs_.count(document_id) == 0) {
+    // removal no longer touches the posting lists, there is nothing left to split between threads
+    RemoveDocument(document_id);
+}
+
+void SearchServer::RemoveDocuments(const std::vector<int>& document_ids) {
+    std::unordered_set<int> removed_ids;
+    for (const int document_id : document_ids) {
+        if (EraseDocument(document_id)) {
+            removed_ids.insert(document_id);
+        }
+    }
+    if (removed_ids.empty()) {
         return;
     }
-    const auto& words_freqs = GetWordFrequencies(document_id);
-    vector<const std::string_view *> words(words_freqs.size());
-    std::transform(policy,
-        words_freqs.begin(), words_freqs.end(),
-        words.begin(),
-        [](const auto &word_freq) {
-            return &word_freq.first;
-        });
+    document_ids_.erase(std::remove_if(document_ids_.begin(), document_ids_.end(), [&removed_ids](int document_id) {
+        return removed_ids.count(document_id) > 0;
+    }), document_ids_.end());
+    executor_->ParallelFor(shards_.size(), [this](size_t shard_index) {
+        shards_[shard_index].CompactSegments();
+    });
+    generation_ = NextGeneration();
+}
 
-    std::for_each(policy,
-        words.begin(), words.end(),
-        [&](const auto& word) {
-            word_to_document_freqs_.at(*word).erase(document_id);
+void SearchServer::CompactIndex() {
+    executor_->ParallelFor(shards_.size(), [this](size_t shard_index) {
+        if (shards_[shard_index].GetRemovedDocumentCount() > 0) {
+            shards_[shard_index].Compact();
         }
-    );
+    });
+}
 
-    document_to_word_freqs_.erase(document_id);
-    documents_.erase(document_id);
-    {
-        auto iter = find(document_ids_.begin(), document_ids_.end(), document_id);
-        document_ids_.erase(iter);
+int SearchServer::GetRemovedDocumentCount() const {
+    int removed_count = 0;
+    for (const IndexShard& shard : shards_) {
+        removed_count += shard.GetRemovedDocumentCount();
+    }
+    return removed_count;
+}
+
+bool SearchServer::EraseDocument(int document_id) {
+    const auto shard_iter = document_shards_.find(document_id);
+    if (shard_iter == document_shards_.end()) {
+        return false;
+    }
+    shards_[shard_iter->second].RemoveDocument(document_id);
+    const auto term_freqs_iter = document_term_freqs_.find(document_id);
+    for (const TermFreq& term_freq : term_freqs_iter->second) {
+        dictionary_.Release(term_freq.term_id);
+    }
+    document_shards_.erase(shard_iter);
+    document_term_freqs_.erase(term_freqs_iter);
+    ReleaseDocumentText(document_id);
+    return true;
+}
+
+std::map<std::string_view, double> SearchServer::GetWordFrequencies(int document_id) const {
+    std::map<std::string_view, double> word_freqs;
+    for (const auto& [term_id, term_freq] : GetTermFrequencies(document_id)) {
+        word_freqs.emplace(dictionary_.GetWord(term_id), term_freq);
     }
+    return word_freqs;
 }
 
-const map<string_view, double>& SearchServer::GetWordFrequencies(int document_id) const {
-    auto iter = document_to_word_freqs_.find(document_id);
-    return iter->second;
+const SnapshotArray<TermFreq>& SearchServer::GetTermFrequencies(int document_id) const {
+    static const SnapshotArray<TermFreq> empty_term_freqs;
+    const auto iter = document_term_freqs_.find(document_id);
+    return iter == document_term_freqs_.end() ? empty_term_freqs : iter->second;
 }
 /*
 bool SearchServer::fillWordsIds(const set<string>& words, int id) {
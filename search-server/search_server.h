@@ -3,6 +3,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <tuple>
 #include <set>
 #include <stdexcept>
@@ -13,13 +14,71 @@
 #include "log_duration.h"
 #include <execution>
 #include <string_view>
-#include <deque>
-#include "concurrent_map.h"
+#include <limits>
+#include <thread>
+#include "index_shard.h"
+#include "query_profiler.h"
+#include "top_documents.h"
+#include "thread_pool.h"
+#include "snapshot.h"
+#include "text_arena.h"
+#include "term_dictionary.h"
+#include <memory>
+#include <cstdint>
+#include <type_traits>
 
 using namespace std;
 
 const int MAX_RESULT_DOCUMENT_COUNT = 5;
-const double EPSILON = 1e-6;
+
+// How a shard walks its posting lists. Both modes return the same documents:
+// EXHAUSTIVE scores every posting of every plus word,
+// MAX_SCORE stops scanning the lists of words whose upper bound cannot lift a new document
+// into the result and only probes them for the documents that still can get there
+enum class QueryEvaluation {
+    EXHAUSTIVE,
+    MAX_SCORE,
+};
+
+// A document for SearchServer::AddDocuments
+struct NewDocument {
+    int id = 0;
+    std::string_view text;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    std::vector<int> ratings;
+};
+
+// A query parsed once to be run many times: the words without stop words, sorted and deduplicated,
+// together with their term ids and IDF. The terms are resolved by the server that prepared the query
+// and stay valid until the server changes; after that they are resolved again on every use
+class PreparedQuery {
+public:
+    const std::vector<std::string>& GetPlusWords() const {
+        return plus_words_;
+    }
+
+    const std::vector<std::string>& GetMinusWords() const {
+        return minus_words_;
+    }
+
+private:
+    friend class SearchServer;
+
+    struct Terms {
+        // plus words present in the server, with their IDF
+        std::vector<IndexShard::QueryTerm> plus_terms;
+        // the term of every plus word, TermDictionary::NO_TERM if no document has it
+        std::vector<uint32_t> plus_word_terms;
+        // minus words present in the server
+        std::vector<uint32_t> minus_terms;
+    };
+
+    std::vector<std::string> plus_words_;
+    std::vector<std::string> minus_words_;
+    // generation of the server the terms were resolved at
+    uint64_t generation_ = 0;
+    Terms terms_;
+};
 
 class SearchServer {
 public:
@@ -29,31 +88,118 @@ public:
     explicit SearchServer(const std::string& stop_words_text);
     explicit SearchServer(std::string_view stop_words_text);
 
+    // A copy stores the texts and words of its own documents; the snapshot file, the thread pool
+    // and the query profiler are shared with the original
+    SearchServer(const SearchServer& other);
+    SearchServer& operator=(const SearchServer& other);
+    SearchServer(SearchServer&&) = default;
+    SearchServer& operator=(SearchServer&&) = default;
+
+    // max_result_count limits the size of the result, the best documents are returned
     template <typename DocumentPredicate>
-    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate) const;
-    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
     std::vector<Document> FindTopDocuments(std::string_view raw_query) const;
 
     template <typename DocumentPredicate>
     std::vector<Document> FindTopDocuments(const std::execution::sequenced_policy& policy,
-        std::string_view raw_query, DocumentPredicate document_predicate) const;
+        std::string_view raw_query, DocumentPredicate document_predicate,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
     std::vector<Document> FindTopDocuments(const std::execution::sequenced_policy& policy,
-        std::string_view raw_query, DocumentStatus status) const;
+        std::string_view raw_query, DocumentStatus status,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
     std::vector<Document> FindTopDocuments(const std::execution::sequenced_policy& policy,
         std::string_view raw_query) const;
 
     template <typename DocumentPredicate>
     std::vector<Document> FindTopDocuments(const std::execution::parallel_policy& policy,
-        std::string_view raw_query, DocumentPredicate document_predicate) const;
+        std::string_view raw_query, DocumentPredicate document_predicate,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
     std::vector<Document> FindTopDocuments(const std::execution::parallel_policy& policy,
-        std::string_view raw_query, DocumentStatus status) const;
+        std::string_view raw_query, DocumentStatus status,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
     std::vector<Document> FindTopDocuments(const std::execution::parallel_policy& policy,
         std::string_view raw_query) const;
 
+    // Throws std::invalid_argument if the query has an invalid word, as FindTopDocuments does
+    PreparedQuery PrepareQuery(std::string_view raw_query) const;
+
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const PreparedQuery& query, DocumentPredicate document_predicate,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(const PreparedQuery& query, DocumentStatus status,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(const PreparedQuery& query) const;
+
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const std::execution::sequenced_policy& policy,
+        const PreparedQuery& query, DocumentPredicate document_predicate,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(const std::execution::sequenced_policy& policy,
+        const PreparedQuery& query, DocumentStatus status,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(const std::execution::sequenced_policy& policy,
+        const PreparedQuery& query) const;
+
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const std::execution::parallel_policy& policy,
+        const PreparedQuery& query, DocumentPredicate document_predicate,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(const std::execution::parallel_policy& policy,
+        const PreparedQuery& query, DocumentStatus status,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(const std::execution::parallel_policy& policy,
+        const PreparedQuery& query) const;
+
+    // Answers every query as FindTopDocuments(raw_query) does, spreading the queries over the server's worker threads.
+    // The i-th result belongs to the i-th query; the server must not be modified while the batch runs
+    std::vector<std::vector<Document>> FindTopDocumentsBatch(const std::vector<std::string_view>& raw_queries) const;
+
     void AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
 
+    // Adds the documents with the term ids and the number of documents per shard a sequence of AddDocument calls
+    // would give, but tokenizes them and deduplicates their words on the worker threads, and fills every shard
+    // with a contiguous part of the batch in a single task. The batch is checked as a whole
+    // before the index is touched: if any id or word is invalid, std::invalid_argument is thrown and nothing is added
+    void AddDocuments(const std::vector<NewDocument>& documents);
+
+    void SetQueryEvaluation(QueryEvaluation query_evaluation);
+
+    // Every FindTopDocuments call is recorded into the profiler; nullptr, the default, turns the recording off.
+    // Must not be called while queries run
+    void SetQueryProfiler(std::shared_ptr<QueryProfiler> query_profiler);
+
+    // Writes stop words, documents and the index to a file. Throws std::runtime_error on I/O errors
+    void SaveSnapshot(const std::string& path) const;
+
+    // Opens a file written by SaveSnapshot. The file is memory-mapped, the words and texts of the documents
+    // are used right in it, and the posting lists are copied without decoding, so nothing is re-tokenized.
+    // The mapping lives as long as the server. Throws std::runtime_error if the file is not a snapshot
+    static SearchServer LoadSnapshot(const std::string& path);
+
+    // Redistributes the documents over shard_count shards. The parallel search runs one task per shard
+    void SetShardCount(size_t shard_count);
+
+    // Number of threads FindTopDocumentsBatch runs on, the calling thread included
+    void SetWorkerCount(size_t worker_count);
+
     int GetDocumentCount() const;
 
+    // Changes every time documents are added or removed; no two servers share a generation
+    uint64_t GetGeneration() const {
+        return generation_;
+    }
+
+    // Memory taken by the texts of the documents and by the words of the index
+    ArenaMemoryUsage GetTextMemoryUsage() const;
+    ArenaMemoryUsage GetWordMemoryUsage() const;
+
+    // Size of the inverted index: the number of postings and the memory their lists take
+    size_t GetPostingCount() const;
+    size_t GetPostingByteSize() const;
+
     auto begin() const {
         auto iter = document_ids_.begin();
         return iter;
@@ -64,32 +210,84 @@ public:
         return iter;
     }
 
+    // A removed document is only marked dead in the index; its postings are purged when the dead documents
+    // make up more than half of a segment, when its segment is merged, or by CompactIndex. Unknown documents are ignored
     void RemoveDocument(int document_id);
     void RemoveDocument(const std::execution::sequenced_policy& policy, int document_id);
     void RemoveDocument(const std::execution::parallel_policy& policy, int document_id);
 
+    // Removes the documents as RemoveDocument does, purging the segments that need it once for the whole batch,
+    // one shard per worker thread
+    void RemoveDocuments(const std::vector<int>& document_ids);
+
+    // Purges the postings of every removed document
+    void CompactIndex();
+
+    // Removed documents whose postings are still in the index
+    int GetRemovedDocumentCount() const;
+
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::string_view raw_query, int document_id) const;
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::sequenced_policy& policy,
         std::string_view raw_query, int document_id) const;
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::parallel_policy& policy,
         std::string_view raw_query, int document_id) const;
 
-    const map<string_view, double>& GetWordFrequencies(int document_id) const;
+    // The matched words refer to the words of the prepared query
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const PreparedQuery& query, int document_id) const;
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::sequenced_policy& policy,
+        const PreparedQuery& query, int document_id) const;
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::parallel_policy& policy,
+        const PreparedQuery& query, int document_id) const;
+
+    // Matches the documents as MatchDocument does, parsing the query once and looking the words up
+    // in the terms of every document. results[i] is for document_ids[i]; results is resized to fit,
+    // and the word lists already in it are reused. The parallel version spreads the documents over
+    // the worker threads. Throws std::out_of_range if any of the documents is unknown
+    void MatchDocuments(std::string_view raw_query, const std::vector<int>& document_ids,
+        std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>>& results) const;
+    void MatchDocuments(const std::execution::sequenced_policy& policy, std::string_view raw_query,
+        const std::vector<int>& document_ids, std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>>& results) const;
+    void MatchDocuments(const std::execution::parallel_policy& policy, std::string_view raw_query,
+        const std::vector<int>& document_ids, std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>>& results) const;
+
+    void MatchDocuments(const PreparedQuery& query, const std::vector<int>& document_ids,
+        std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>>& results) const;
+    void MatchDocuments(const std::execution::sequenced_policy& policy, const PreparedQuery& query,
+        const std::vector<int>& document_ids, std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>>& results) const;
+    void MatchDocuments(const std::execution::parallel_policy& policy, const PreparedQuery& query,
+        const std::vector<int>& document_ids, std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>>& results) const;
+
+    // Empty for an unknown document. The map is built from the term ids of the document on every call
+    std::map<std::string_view, double> GetWordFrequencies(int document_id) const;
+
+    // Terms of the document sorted by id; empty for an unknown document
+    const SnapshotArray<TermFreq>& GetTermFrequencies(int document_id) const;
 
     //bool fillWordsIds(const set<string>& words, int id);
 
 private:
-    struct DocumentData {
-        int rating;
-        DocumentStatus status;
-    };
     std::set<std::string, std::less<>> stop_words_;
-    std::map<std::string_view, std::map<int, double>> word_to_document_freqs_;
-    std::map<int, DocumentData> documents_;
+    // every document lives in one of the shards, each shard being a separate inverted index
+    std::vector<IndexShard> shards_ = std::vector<IndexShard>(std::max(1u, std::thread::hardware_concurrency()));
+    std::unordered_map<int, size_t> document_shards_;
+    // number of documents containing each word over all the shards, IDF is computed from it
+    TermDictionary dictionary_;
+    QueryEvaluation query_evaluation_ = QueryEvaluation::EXHAUSTIVE;
+    // started once and reused by every batch of queries, and by the copies of the server
+    std::shared_ptr<ThreadPool> executor_ = std::make_shared<ThreadPool>(std::max(1u, std::thread::hardware_concurrency()));
     std::vector<int> document_ids_;
-    std::map<int, std::map<std::string_view, double>> document_to_word_freqs_;
+    // the terms of a loaded document stay in the snapshot
+    std::unordered_map<int, SnapshotArray<TermFreq>> document_term_freqs_;
     std::map<std::set<string>, int> words_ids_;
-    std::deque<std::string> all_docs_;
+    // Texts of the documents, either in document_text_arena_ or in the snapshot file.
+    // The index does not refer to the texts, so they are freed and compacted on removal
+    std::unordered_map<int, std::string_view> document_texts_;
+    TextArena document_text_arena_;
+    std::shared_ptr<const MappedFile> snapshot_file_;
+    std::shared_ptr<QueryProfiler> query_profiler_;
+    uint64_t generation_ = NextGeneration();
+
+    static uint64_t NextGeneration();
 
     static bool IsValidWord(std::string_view word);
 
@@ -99,6 +297,25 @@ private:
 
     static int ComputeAverageRating(const std::vector<int>& ratings);
 
+    // Words of a document with their term frequencies, sorted by word
+    struct ParsedDocument {
+        int word_count = 0;
+        std::vector<std::pair<std::string_view, double>> word_freqs;
+    };
+
+    // Throws std::invalid_argument if the document has an invalid word
+    ParsedDocument ParseDocument(std::string_view text) const;
+
+    // Terms of a parsed document sorted by id; every term gets one more document
+    std::vector<TermFreq> AcquireTerms(const ParsedDocument& document);
+
+    // Terms of every parsed document, each one sorted by id, with the ids a sequence of AcquireTerms calls would give.
+    // The words are deduplicated on the worker threads, each one taking the words of its hash partition,
+    // so the dictionary is only visited once per distinct word of the batch
+    std::vector<std::vector<TermFreq>> AcquireTerms(const std::vector<ParsedDocument>& documents);
+
+    void CheckNewDocumentId(int document_id) const;
+
     struct QueryWord {
         std::string_view data;
         bool is_minus;
@@ -114,19 +331,75 @@ private:
 
     Query ParseQuery(std::string_view text) const;
 
-    double ComputeWordInverseDocumentFreq(std::string_view word) const;
+    double ComputeInverseDocumentFreq(int word_document_count) const;
+
+    // Terms of the words as of now, with IDF over all the shards
+    PreparedQuery::Terms ResolveTerms(const std::vector<std::string>& plus_words,
+        const std::vector<std::string>& minus_words) const;
+
+    // The terms of the query, or, if the server has changed since it was prepared, the ones resolved into fresh_terms
+    const PreparedQuery::Terms& GetTerms(const PreparedQuery& query, PreparedQuery::Terms& fresh_terms) const;
+
+    static bool HasDocumentTerm(const SnapshotArray<TermFreq>& term_freqs, uint32_t term_id);
+
+    bool HasDocumentWord(const SnapshotArray<TermFreq>& term_freqs, std::string_view word) const;
+
+    // A query ready to be matched against the terms of documents
+    struct MatchTerms {
+        // sorted and unique, each with its term or TermDictionary::NO_TERM
+        std::vector<std::string_view> plus_words;
+        std::vector<uint32_t> plus_word_terms;
+        std::vector<uint32_t> minus_terms;
+    };
+
+    MatchTerms GetMatchTerms(std::string_view raw_query) const;
+    MatchTerms GetMatchTerms(const PreparedQuery& query) const;
+
+    void MatchDocumentTerms(const MatchTerms& terms, int document_id,
+        std::tuple<std::vector<std::string_view>, DocumentStatus>& result) const;
+
+    template <typename ExecutionPolicy>
+    void MatchAllDocuments(const ExecutionPolicy& policy, const MatchTerms& terms, const std::vector<int>& document_ids,
+        std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>>& results) const;
 
+    // Throws std::out_of_range if there is no such document
+    const IndexShard& GetShard(int document_id) const;
+
+    size_t ChooseShard() const;
+
+    void ReleaseDocumentText(int document_id);
+
+    // Removes the document from everything but the posting lists and document_ids_; false for an unknown document
+    bool EraseDocument(int document_id);
+
+    // Feed every matched document into top_documents
+    template <typename DocumentPredicate>
+    void FindAllDocuments(const PreparedQuery::Terms& terms, DocumentPredicate document_predicate, TopDocuments& top_documents,
+        QueryStats& stats) const;
     template <typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments(const Query& query, DocumentPredicate document_predicate) const;
+    void FindAllDocuments(const std::execution::sequenced_policy& policy, const PreparedQuery::Terms& terms,
+        DocumentPredicate document_predicate, TopDocuments& top_documents, QueryStats& stats) const;
     template <typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments(const std::execution::sequenced_policy& policy, const Query& query, 
-        DocumentPredicate document_predicate) const;
+    void FindAllDocuments(const std::execution::parallel_policy& policy, const PreparedQuery::Terms& terms,
+        DocumentPredicate document_predicate, TopDocuments& top_documents, QueryStats& stats) const;
+
     template <typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments(const std::execution::parallel_policy& policy, const Query& query, 
-        DocumentPredicate document_predicate) const;
+    void FindShardDocuments(const IndexShard& shard, const std::vector<IndexShard::QueryTerm>& plus_terms,
+        const std::vector<uint32_t>& minus_terms, DocumentPredicate document_predicate, TopDocuments& top_documents,
+        QueryStats& stats) const;
 
+    // Times the parsing of the query when there is a profiler
     template <typename ExecutionPolicy, typename DocumentPredicate>
-    std::vector<Document> FindMatchedDocuments(const ExecutionPolicy& policy, std::string_view raw_query, DocumentPredicate document_predicate) const;
+    std::vector<Document> FindMatchedDocuments(const ExecutionPolicy& policy, std::string_view raw_query,
+        DocumentPredicate document_predicate, size_t max_result_count) const;
+
+    // raw_query is the text the query was prepared from, empty for a query prepared by the caller
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> FindMatchedDocuments(const ExecutionPolicy& policy, const PreparedQuery& query,
+        DocumentPredicate document_predicate, size_t max_result_count,
+        std::string_view raw_query = {}, uint64_t parse_ns = 0) const;
+
+    void RecordQuery(std::string_view raw_query, const PreparedQuery& query, const QueryStats& stats) const;
 };
 
 template <typename StringContainer>
@@ -139,123 +412,134 @@ SearchServer::SearchServer(const StringContainer& stop_words) :
 }
 
 template <typename ExecutionPolicy, typename DocumentPredicate>
-std::vector<Document> SearchServer::FindMatchedDocuments(const ExecutionPolicy& policy, std::string_view raw_query, DocumentPredicate document_predicate) const {
-    auto query = ParseQuery(raw_query);
-    std::sort(policy, query.minus_words.begin(), query.minus_words.end());
-    const auto minus_word = std::unique(policy, query.minus_words.begin(), query.minus_words.end());
-    query.minus_words.erase(minus_word, query.minus_words.end());
-    std::sort(policy, query.plus_words.begin(), query.plus_words.end());
-    const auto plus_word = std::unique(policy, query.plus_words.begin(), query.plus_words.end());
-    query.plus_words.erase(plus_word, query.plus_words.end());
-    auto matched_documents = FindAllDocuments(policy, query, document_predicate);
-    sort(policy,
-        matched_documents.begin(), matched_documents.end(),
-        [](const Document& lhs, const Document& rhs) {
-            if (abs(lhs.relevance - rhs.relevance) < EPSILON) {
-                return lhs.rating > rhs.rating;
-            }
-            else {
-                return lhs.relevance > rhs.relevance;
-            }
-        });
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+std::vector<Document> SearchServer::FindMatchedDocuments(const ExecutionPolicy& policy, std::string_view raw_query,
+    DocumentPredicate document_predicate, size_t max_result_count) const {
+    if (query_profiler_ == nullptr) {
+        return FindMatchedDocuments(policy, PrepareQuery(raw_query), document_predicate, max_result_count);
     }
-    return matched_documents;
+    const uint64_t parse_start = QueryProfiler::Now();
+    const PreparedQuery query = PrepareQuery(raw_query);
+    return FindMatchedDocuments(policy, query, document_predicate, max_result_count, raw_query, QueryProfiler::Now() - parse_start);
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindMatchedDocuments(const ExecutionPolicy& policy, const PreparedQuery& query,
+    DocumentPredicate document_predicate, size_t max_result_count, std::string_view raw_query, uint64_t parse_ns) const {
+    const uint64_t search_start = query_profiler_ != nullptr ? QueryProfiler::Now() : 0;
+    QueryStats stats;
+    PreparedQuery::Terms fresh_terms;
+    TopDocuments top_documents(max_result_count);
+    FindAllDocuments(policy, GetTerms(query, fresh_terms), document_predicate, top_documents, stats);
+    std::vector<Document> documents = top_documents.Extract();
+    if (query_profiler_ != nullptr) {
+        stats.parse_ns = parse_ns;
+        stats.search_ns = QueryProfiler::Now() - search_start;
+        RecordQuery(raw_query, query, stats);
+    }
+    return documents;
 }
 
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate) const {
-    return FindMatchedDocuments(std::execution::seq, raw_query, document_predicate);
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate,
+    size_t max_result_count) const {
+    return FindMatchedDocuments(std::execution::seq, raw_query, document_predicate, max_result_count);
 }
 
 template <typename DocumentPredicate>
 std::vector<Document> SearchServer::FindTopDocuments(const std::execution::sequenced_policy& policy, 
-    std::string_view raw_query, DocumentPredicate document_predicate) const {
-    return FindTopDocuments(raw_query, document_predicate);
+    std::string_view raw_query, DocumentPredicate document_predicate, size_t max_result_count) const {
+    return FindTopDocuments(raw_query, document_predicate, max_result_count);
 }
 
 template <typename DocumentPredicate>
 std::vector<Document> SearchServer::FindTopDocuments(const std::execution::parallel_policy& policy, 
-    std::string_view raw_query, DocumentPredicate document_predicate) const {
-    return FindMatchedDocuments(std::execution::par, raw_query, document_predicate);;
+    std::string_view raw_query, DocumentPredicate document_predicate, size_t max_result_count) const {
+    return FindMatchedDocuments(std::execution::par, raw_query, document_predicate, max_result_count);
 }
 
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(const Query& query, DocumentPredicate document_predicate) const {
-    std::map<int, double> document_to_relevance;
-    for (const auto& word : query.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-        for (const auto &[document_id, term_freq] : word_to_document_freqs_.at(word)) {
-            
-            const auto& document_data = documents_.at(document_id);
-            
-            if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                document_to_relevance[document_id] += term_freq * inverse_document_freq;
-            }
-        }
+std::vector<Document> SearchServer::FindTopDocuments(const PreparedQuery& query, DocumentPredicate document_predicate,
+    size_t max_result_count) const {
+    return FindMatchedDocuments(std::execution::seq, query, document_predicate, max_result_count);
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(const std::execution::sequenced_policy& policy,
+    const PreparedQuery& query, DocumentPredicate document_predicate, size_t max_result_count) const {
+    return FindTopDocuments(query, document_predicate, max_result_count);
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(const std::execution::parallel_policy& policy,
+    const PreparedQuery& query, DocumentPredicate document_predicate, size_t max_result_count) const {
+    return FindMatchedDocuments(std::execution::par, query, document_predicate, max_result_count);
+}
+
+template <typename ExecutionPolicy>
+void SearchServer::MatchAllDocuments(const ExecutionPolicy& policy, const MatchTerms& terms, const std::vector<int>& document_ids,
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>>& results) const {
+    results.resize(document_ids.size());
+    if constexpr (std::is_same_v<ExecutionPolicy, std::execution::parallel_policy>) {
+        executor_->ParallelFor(document_ids.size(), [this, &terms, &document_ids, &results](size_t i) {
+            MatchDocumentTerms(terms, document_ids[i], results[i]);
+        });
     }
-    
-    for (const auto& word : query.minus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        for (const auto &[document_id, _] : word_to_document_freqs_.at(word)) {
-            document_to_relevance.erase(document_id);
+    else {
+        for (size_t i = 0; i < document_ids.size(); ++i) {
+            MatchDocumentTerms(terms, document_ids[i], results[i]);
         }
     }
+}
 
-    std::vector<Document> matched_documents;
-    for (const auto &[document_id, relevance] : document_to_relevance) {
-        matched_documents.push_back({ document_id, relevance, documents_.at(document_id).rating });
+template <typename DocumentPredicate>
+void SearchServer::FindAllDocuments(const PreparedQuery::Terms& terms, DocumentPredicate document_predicate,
+    TopDocuments& top_documents, QueryStats& stats) const {
+    for (const IndexShard& shard : shards_) {
+        FindShardDocuments(shard, terms.plus_terms, terms.minus_terms, document_predicate, top_documents, stats);
     }
-    return matched_documents;
 }
 
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(const std::execution::sequenced_policy& policy, const Query& query,
-    DocumentPredicate document_predicate) const {
-    return FindAllDocuments(query, document_predicate);
+void SearchServer::FindAllDocuments(const std::execution::sequenced_policy& policy, const PreparedQuery::Terms& terms,
+    DocumentPredicate document_predicate, TopDocuments& top_documents, QueryStats& stats) const {
+    FindAllDocuments(terms, document_predicate, top_documents, stats);
 }
 
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(const std::execution::parallel_policy& policy, const Query& query,
-    DocumentPredicate document_predicate) const {
-    ConcurrentMap<int, double> document_to_relevance(10);
-    for_each(policy,
-        query.plus_words.begin(), query.plus_words.end(),
-        [&](const auto& word) {
-            if (word_to_document_freqs_.count(word) != 0) {
-                const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-                for (const auto& [document_id, term_freq] : word_to_document_freqs_.at(word)) {
-                    const auto& document_data = documents_.at(document_id);
-                    if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                        document_to_relevance[document_id].ref_to_value += term_freq * inverse_document_freq;
-                    }
-                }
-            }
-        }
-    );
-
-    for_each(policy,
-        query.minus_words.begin(), query.minus_words.end(),
-        [&](const auto& word) {
-            if (word_to_document_freqs_.count(word) != 0) {
-                for (const auto& [document_id, _] : word_to_document_freqs_.at(word)) {
-                    document_to_relevance.erase(document_id);
-                }
-            }
+void SearchServer::FindAllDocuments(const std::execution::parallel_policy& policy, const PreparedQuery::Terms& terms,
+    DocumentPredicate document_predicate, TopDocuments& top_documents, QueryStats& stats) const {
+    // Every shard collects its own top and stats, nothing is shared until the merge
+    const auto& plus_terms = terms.plus_terms;
+    const auto& minus_terms = terms.minus_terms;
+    std::vector<TopDocuments> shard_tops(shards_.size(), TopDocuments(top_documents.GetMaxCount()));
+    std::vector<QueryStats> shard_stats(shards_.size());
+    std::vector<size_t> shard_indexes(shards_.size());
+    std::iota(shard_indexes.begin(), shard_indexes.end(), 0);
+    std::for_each(policy,
+        shard_indexes.begin(), shard_indexes.end(),
+        [&](size_t shard_index) {
+            FindShardDocuments(shards_[shard_index], plus_terms, minus_terms, document_predicate, shard_tops[shard_index],
+                shard_stats[shard_index]);
         }
     );
+    for (const auto& shard_top : shard_tops) {
+        top_documents.Merge(shard_top);
+    }
+    for (const QueryStats& shard_stat : shard_stats) {
+        stats += shard_stat;
+    }
+}
 
-    std::vector<Document> matched_documents;
-    for (const auto& [document_id, relevance] : document_to_relevance.BuildOrdinaryMap()) {
-        matched_documents.push_back({ document_id, relevance, documents_.at(document_id).rating });
+template <typename DocumentPredicate>
+void SearchServer::FindShardDocuments(const IndexShard& shard, const std::vector<IndexShard::QueryTerm>& plus_terms,
+    const std::vector<uint32_t>& minus_terms, DocumentPredicate document_predicate, TopDocuments& top_documents,
+    QueryStats& stats) const {
+    if (query_evaluation_ == QueryEvaluation::MAX_SCORE) {
+        shard.FindDocumentsMaxScore(plus_terms, minus_terms, document_predicate, top_documents, stats);
+    }
+    else {
+        shard.FindDocuments(plus_terms, minus_terms, document_predicate, top_documents, stats);
     }
-    return matched_documents;
 }
 
 /*
@@ -0,0 +1,140 @@
+#include "snapshot.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std::string_literals;
+
+SnapshotWriter::SnapshotWriter(const std::string& path)
+    : path_(path)
+    , output_(path, std::ios::binary | std::ios::trunc) {
+    if (!output_) {
+        throw std::runtime_error("Cannot create snapshot "s + path);
+    }
+}
+
+void SnapshotWriter::WriteString(std::string_view str) {
+    Write<uint64_t>(str.size());
+    WriteBytes(str.data(), str.size());
+}
+
+void SnapshotWriter::WriteBytes(const void* data, size_t size) {
+    output_.write(static_cast<const char*>(data), size);
+    position_ += size;
+}
+
+void SnapshotWriter::Align(size_t alignment) {
+    static const char ZEROS[alignof(std::max_align_t)] = {};
+    WriteBytes(ZEROS, (alignment - position_ % alignment) % alignment);
+}
+
+void SnapshotWriter::Finish() {
+    output_.flush();
+    if (!output_) {
+        throw std::runtime_error("Cannot write snapshot "s + path_);
+    }
+}
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path) {
+    file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_ == INVALID_HANDLE_VALUE) {
+        file_ = nullptr;
+        throw std::runtime_error("Cannot open snapshot "s + path);
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file_, &size)) {
+        CloseHandle(file_);
+        throw std::runtime_error("Cannot open snapshot "s + path);
+    }
+    size_ = static_cast<size_t>(size.QuadPart);
+    if (size_ == 0) {
+        return;
+    }
+    mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    data_ = mapping_ != nullptr ? static_cast<const char*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+    if (data_ == nullptr) {
+        if (mapping_ != nullptr) {
+            CloseHandle(mapping_);
+        }
+        CloseHandle(file_);
+        throw std::runtime_error("Cannot map snapshot "s + path);
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (data_ != nullptr) {
+        UnmapViewOfFile(data_);
+        CloseHandle(mapping_);
+    }
+    CloseHandle(file_);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path) {
+    const int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        throw std::runtime_error("Cannot open snapshot "s + path);
+    }
+    struct stat file_stat;
+    if (fstat(file, &file_stat) != 0) {
+        close(file);
+        throw std::runtime_error("Cannot open snapshot "s + path);
+    }
+    size_ = static_cast<size_t>(file_stat.st_size);
+    if (size_ > 0) {
+        void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, file, 0);
+        if (data == MAP_FAILED) {
+            close(file);
+            throw std::runtime_error("Cannot map snapshot "s + path);
+        }
+        data_ = static_cast<const char*>(data);
+    }
+    // the mapping outlives the descriptor
+    close(file);
+}
+
+MappedFile::~MappedFile() {
+    if (data_ != nullptr) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+}
+
+#endif
+
+size_t SnapshotReader::ReadSize(size_t min_item_size) {
+    const auto size = Read<uint64_t>();
+    if (size > (data_.size() - position_) / min_item_size) {
+        throw std::runtime_error("Snapshot is truncated");
+    }
+    return static_cast<size_t>(size);
+}
+
+std::string_view SnapshotReader::ReadString() {
+    const auto size = Read<uint64_t>();
+    if (size > data_.size() - position_) {
+        throw std::runtime_error("Snapshot is truncated");
+    }
+    return { Take(size), size };
+}
+
+void SnapshotReader::ThrowCorrupted() {
+    throw std::runtime_error("Snapshot is corrupted");
+}
+
+const char* SnapshotReader::Take(size_t size) {
+    if (size > data_.size() - position_) {
+        throw std::runtime_error("Snapshot is truncated");
+    }
+    const char* data = data_.data() + position_;
+    position_ += size;
+    return data;
+}
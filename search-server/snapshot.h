@@ -0,0 +1,235 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Building blocks of the index files written by SearchServer::SaveSnapshot.
+// Numbers are stored as they lie in memory, so a snapshot is read back on the platform that wrote it;
+// the header catches a file from another version or with another byte order.
+// Array elements start at a multiple of their alignment, so a mapped array can be used in place
+
+const uint64_t SNAPSHOT_MAGIC = 0x5853444e49524553; // "SERINDSX" in little endian
+const uint32_t SNAPSHOT_VERSION = 6;
+
+// Elements that either belong to the array or lie in the data of a snapshot, which must outlive the array.
+// Both are read the same way; the first change copies mapped elements into memory of the array's own
+template <typename T>
+class SnapshotArray {
+public:
+    using value_type = T;
+
+    SnapshotArray() = default;
+
+    SnapshotArray(std::vector<T> values)
+        : values_(std::move(values)) {
+    }
+
+    const T* data() const {
+        return mapped_ != nullptr ? mapped_ : values_.data();
+    }
+
+    size_t size() const {
+        return mapped_ != nullptr ? mapped_size_ : values_.size();
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    const T* begin() const {
+        return data();
+    }
+
+    const T* end() const {
+        return data() + size();
+    }
+
+    const T& operator[](size_t index) const {
+        return data()[index];
+    }
+
+    const T& front() const {
+        return data()[0];
+    }
+
+    const T& back() const {
+        return data()[size() - 1];
+    }
+
+    // The elements to change, copied out of the snapshot if they are still there
+    std::vector<T>& Mutable() {
+        if (mapped_ != nullptr) {
+            values_.assign(mapped_, mapped_ + mapped_size_);
+            mapped_ = nullptr;
+            mapped_size_ = 0;
+        }
+        return values_;
+    }
+
+    // Drops the spare capacity of the elements copied out; a snapshot has none
+    void ShrinkToFit() {
+        values_.shrink_to_fit();
+    }
+
+    // Memory allocated by the array; elements in a snapshot take none
+    size_t GetByteSize() const {
+        return values_.capacity() * sizeof(T);
+    }
+
+private:
+    friend class SnapshotReader;
+
+    std::vector<T> values_;
+    const T* mapped_ = nullptr;
+    size_t mapped_size_ = 0;
+};
+
+// Appends values to a file; throws std::runtime_error if the file cannot be written
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(const std::string& path);
+
+    template <typename T>
+    void Write(const T& value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        WriteBytes(&value, sizeof(value));
+    }
+
+    // The size, then the elements from a multiple of their alignment
+    template <typename T>
+    void WriteArray(const std::vector<T>& values) {
+        WriteElements(values.data(), values.size());
+    }
+
+    template <typename T>
+    void WriteArray(const SnapshotArray<T>& values) {
+        WriteElements(values.data(), values.size());
+    }
+
+    void WriteString(std::string_view str);
+
+    // Flushes the file and checks that everything has been written
+    void Finish();
+
+private:
+    std::string path_;
+    std::ofstream output_;
+    uint64_t position_ = 0;
+
+    template <typename T>
+    void WriteElements(const T* values, size_t size) {
+        static_assert(std::is_trivially_copyable_v<T> && alignof(T) <= alignof(std::max_align_t));
+        Write<uint64_t>(size);
+        Align(alignof(T));
+        WriteBytes(values, size * sizeof(T));
+    }
+
+    void WriteBytes(const void* data, size_t size);
+
+    void Align(size_t alignment);
+};
+
+// Read-only mapping of a whole file into memory
+class MappedFile {
+public:
+    // Throws std::runtime_error if the file cannot be opened or mapped
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::string_view GetData() const {
+        return { data_, size_ };
+    }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    void* file_ = nullptr;
+    void* mapping_ = nullptr;
+#endif
+};
+
+// Reads values in the order SnapshotWriter wrote them.
+// Throws std::runtime_error on reading past the end of the data; callers check the values
+// they index with, and report them with ThrowCorrupted
+class SnapshotReader {
+public:
+    explicit SnapshotReader(std::string_view data)
+        : data_(data) {
+    }
+
+    template <typename T>
+    T Read() {
+        static_assert(std::is_trivially_copyable_v<T>);
+        T value;
+        std::memcpy(&value, Take(sizeof(T)), sizeof(T));
+        return value;
+    }
+
+    // A number of items, each taking at least min_item_size bytes of the data that follows
+    size_t ReadSize(size_t min_item_size);
+
+    template <typename T>
+    void ReadArray(std::vector<T>& values) {
+        const size_t size = ReadArraySize<T>();
+        values.resize(size);
+        if (size > 0) {
+            std::memcpy(values.data(), Take(size * sizeof(T)), size * sizeof(T));
+        }
+    }
+
+    // The array is left in the data, nothing is copied, unless the data is misaligned for T
+    template <typename T>
+    void ReadArray(SnapshotArray<T>& values) {
+        const size_t size = ReadArraySize<T>();
+        const char* data = size > 0 ? Take(size * sizeof(T)) : nullptr;
+        values.values_.clear();
+        values.mapped_ = nullptr;
+        values.mapped_size_ = 0;
+        if (data != nullptr && reinterpret_cast<uintptr_t>(data) % alignof(T) == 0) {
+            values.mapped_ = reinterpret_cast<const T*>(data);
+            values.mapped_size_ = size;
+        }
+        else if (data != nullptr) {
+            values.values_.resize(size);
+            std::memcpy(values.values_.data(), data, size * sizeof(T));
+        }
+    }
+
+    // The string stays in the data, nothing is copied
+    std::string_view ReadString();
+
+    [[noreturn]] static void ThrowCorrupted();
+
+private:
+    std::string_view data_;
+    size_t position_ = 0;
+
+    template <typename T>
+    size_t ReadArraySize() {
+        static_assert(std::is_trivially_copyable_v<T>);
+        const auto size = Read<uint64_t>();
+        Skip((alignof(T) - position_ % alignof(T)) % alignof(T));
+        if (size > (data_.size() - position_) / sizeof(T)) {
+            throw std::runtime_error("Snapshot is truncated");
+        }
+        return static_cast<size_t>(size);
+    }
+
+    const char* Take(size_t size);
+
+    void Skip(size_t size) {
+        Take(size);
+    }
+};
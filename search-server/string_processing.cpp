@@ -1,22 +1,186 @@
 #include "string_processing.h"
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define TEXT_SCAN_X86
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace {
+
+// Text is scanned in blocks of 64 bytes; bit i of a mask stands for the i-th byte of the block
+const size_t SCAN_BLOCK_SIZE = 64;
+
+struct BlockMasks {
+    uint64_t spaces;
+    uint64_t controls;
+};
+
+using ClassifyFunction = BlockMasks (*)(const char* block);
+
+BlockMasks ClassifyScalar(const char* block) {
+    BlockMasks masks = { 0, 0 };
+    for (size_t i = 0; i < SCAN_BLOCK_SIZE; ++i) {
+        const auto c = static_cast<unsigned char>(block[i]);
+        masks.spaces |= static_cast<uint64_t>(c == ' ') << i;
+        masks.controls |= static_cast<uint64_t>(c < ' ') << i;
+    }
+    return masks;
+}
+
+#ifdef TEXT_SCAN_X86
+
+// SSE2 is part of x86-64, no check is needed for it
+BlockMasks ClassifySse2(const char* block) {
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i last_control = _mm_set1_epi8(' ' - 1);
+    BlockMasks masks = { 0, 0 };
+    for (size_t i = 0; i < SCAN_BLOCK_SIZE; i += 16) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i));
+        // unsigned bytes not above last_control are the ones left unchanged by min
+        const __m128i controls = _mm_cmpeq_epi8(_mm_min_epu8(bytes, last_control), bytes);
+        masks.spaces |= static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, space)))) << i;
+        masks.controls |= static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(controls))) << i;
+    }
+    return masks;
+}
+
+#if defined(__GNUC__)
+#define TEXT_SCAN_AVX2
+
+__attribute__((target("avx2")))
+BlockMasks ClassifyAvx2(const char* block) {
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i last_control = _mm256_set1_epi8(' ' - 1);
+    BlockMasks masks = { 0, 0 };
+    for (size_t i = 0; i < SCAN_BLOCK_SIZE; i += 32) {
+        const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + i));
+        const __m256i controls = _mm256_cmpeq_epi8(_mm256_min_epu8(bytes, last_control), bytes);
+        masks.spaces |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, space)))) << i;
+        masks.controls |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(controls))) << i;
+    }
+    return masks;
+}
+#endif
+
+#endif
+
+bool IsSupported(TextScanLevel level) {
+    switch (level) {
+    case TextScanLevel::SCALAR:
+        return true;
+#ifdef TEXT_SCAN_X86
+    case TextScanLevel::SSE2:
+        return true;
+#endif
+#ifdef TEXT_SCAN_AVX2
+    case TextScanLevel::AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+ClassifyFunction GetClassifyFunction(TextScanLevel level) {
+    switch (level) {
+#ifdef TEXT_SCAN_X86
+    case TextScanLevel::SSE2:
+        return ClassifySse2;
+#endif
+#ifdef TEXT_SCAN_AVX2
+    case TextScanLevel::AVX2:
+        return ClassifyAvx2;
+#endif
+    default:
+        return ClassifyScalar;
+    }
+}
+
+TextScanLevel GetSupportedLevel(TextScanLevel level) {
+    while (!IsSupported(level)) {
+        level = static_cast<TextScanLevel>(static_cast<int>(level) - 1);
+    }
+    return level;
+}
+
+std::atomic<TextScanLevel> text_scan_level{ GetSupportedLevel(TextScanLevel::AVX2) };
+
+int CountTrailingZeros(uint64_t mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(mask);
+#endif
+}
+
+// Masks of the block starting at offset; bytes past the end of the text are neither spaces nor controls
+BlockMasks ClassifyAt(ClassifyFunction classify, std::string_view text, size_t offset) {
+    if (text.size() - offset >= SCAN_BLOCK_SIZE) {
+        return classify(text.data() + offset);
+    }
+    char block[SCAN_BLOCK_SIZE];
+    std::memset(block, 'x', SCAN_BLOCK_SIZE);
+    std::memcpy(block, text.data() + offset, text.size() - offset);
+    return classify(block);
+}
+
+} // namespace
+
+TextScanLevel GetTextScanLevel() {
+    return text_scan_level.load(std::memory_order_relaxed);
+}
+
+void SetTextScanLevel(TextScanLevel level) {
+    text_scan_level.store(GetSupportedLevel(level), std::memory_order_relaxed);
+}
 
 std::vector<std::string_view> SplitIntoWords(std::string_view text) {
     std::vector<std::string_view> words;
     if (text.empty()) {
         return words;
     }
-    size_t j = 0;
-    for (size_t i = 0; i < text.size() - 1; ++i) {
-        if (text[i] == ' ') {
-            if (!text.substr(j, i - j).empty()) {
-                words.push_back(text.substr(j, i - j));
-                j = ++i;
+    const ClassifyFunction classify = GetClassifyFunction(GetTextScanLevel());
+    // the last character is not looked at, so it stays with the last word
+    const size_t scan_size = text.size() - 1;
+    size_t word_begin = 0;
+    for (size_t offset = 0; offset < scan_size; offset += SCAN_BLOCK_SIZE) {
+        uint64_t spaces = ClassifyAt(classify, text, offset).spaces;
+        if (scan_size - offset < SCAN_BLOCK_SIZE) {
+            spaces &= (static_cast<uint64_t>(1) << (scan_size - offset)) - 1;
+        }
+        while (spaces != 0) {
+            const size_t space = offset + CountTrailingZeros(spaces);
+            spaces &= spaces - 1;
+            // a space at the first character of a word does not end it
+            if (space > word_begin) {
+                words.push_back(text.substr(word_begin, space - word_begin));
+                word_begin = space + 1;
             }
         }
     }
-    if (!text.substr(j, text.length() - 1).empty()) {
-        words.push_back(text.substr(j, text.length() - 1));
+    // without a delimiter the only word is cut one character short
+    const std::string_view last_word = word_begin == 0 ? text.substr(0, scan_size) : text.substr(word_begin);
+    if (!last_word.empty()) {
+        words.push_back(last_word);
     }
-
     return words;
-}
\ No newline at end of file
+}
+
+bool HasControlCharacters(std::string_view text) {
+    const ClassifyFunction classify = GetClassifyFunction(GetTextScanLevel());
+    for (size_t offset = 0; offset < text.size(); offset += SCAN_BLOCK_SIZE) {
+        if (ClassifyAt(classify, text, offset).controls != 0) {
+            return true;
+        }
+    }
+    return false;
+}
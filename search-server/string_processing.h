@@ -16,4 +16,23 @@ std::set<std::string, std::less<> > MakeUniqueNonEmptyStrings(const StringContai
     return non_empty_strings;
 }
 
+// Instruction sets the text scanning functions can run on.
+// The best one the CPU supports is chosen when the program starts
+enum class TextScanLevel {
+    SCALAR,
+    SSE2,
+    AVX2,
+};
+
+TextScanLevel GetTextScanLevel();
+
+// Lowers the level, e.g. to compare the implementations; a level the CPU lacks is replaced by the best supported one below it
+void SetTextScanLevel(TextScanLevel level);
+
+// A word ends at a space. A space that follows a word delimiter right away or starts the text
+// belongs to the next word, and the last character of the text is never a delimiter.
+// A text without delimiters loses its last character
 std::vector<std::string_view> SplitIntoWords(std::string_view text);
+
+// Whether the text has any of the characters '\0' to '\x1f'
+bool HasControlCharacters(std::string_view text);
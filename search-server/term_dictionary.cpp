@@ -0,0 +1,173 @@
+#include "term_dictionary.h"
+#include <string>
+
+TermDictionary::TermDictionary(const TermDictionary& other) :
+    words_(other.words_.size()),
+    document_counts_(other.document_counts_),
+    free_term_ids_(other.free_term_ids_),
+    snapshot_text_(other.snapshot_text_),
+    snapshot_word_offsets_(other.snapshot_word_offsets_),
+    snapshot_term_slots_(other.snapshot_term_slots_) {
+    term_ids_.reserve(other.term_ids_.size());
+    for (const auto& [word, term_id] : other.term_ids_) {
+        words_[term_id] = arena_.Store(word);
+        term_ids_.emplace(words_[term_id], term_id);
+    }
+}
+
+TermDictionary& TermDictionary::operator=(const TermDictionary& other) {
+    if (this != &other) {
+        *this = TermDictionary(other);
+    }
+    return *this;
+}
+
+uint32_t TermDictionary::Acquire(std::string_view word, int document_count) {
+    const uint32_t found_term_id = Find(word);
+    if (found_term_id != NO_TERM) {
+        document_counts_.Mutable()[found_term_id] += document_count;
+        return found_term_id;
+    }
+    std::vector<int>& document_counts = document_counts_.Mutable();
+    uint32_t term_id;
+    if (free_term_ids_.empty()) {
+        term_id = static_cast<uint32_t>(document_counts.size());
+        document_counts.push_back(0);
+    }
+    else {
+        term_id = free_term_ids_.back();
+        free_term_ids_.Mutable().pop_back();
+    }
+    if (words_.size() <= term_id) {
+        words_.resize(document_counts.size());
+    }
+    words_[term_id] = arena_.Store(word);
+    document_counts[term_id] = document_count;
+    term_ids_.emplace(words_[term_id], term_id);
+    return term_id;
+}
+
+void TermDictionary::Release(uint32_t term_id) {
+    if (--document_counts_.Mutable()[term_id] > 0) {
+        return;
+    }
+    if (term_id < words_.size() && !words_[term_id].empty()) {
+        term_ids_.erase(words_[term_id]);
+        arena_.Release(words_[term_id]);
+        words_[term_id] = {};
+    }
+    free_term_ids_.Mutable().push_back(term_id);
+}
+
+uint32_t TermDictionary::Find(std::string_view word) const {
+    const auto iter = term_ids_.find(word);
+    if (iter != term_ids_.end()) {
+        return iter->second;
+    }
+    // the id of a snapshot word may have been freed since, and even given to another word
+    const uint32_t term_id = FindSnapshotWord(word);
+    return term_id != NO_TERM && document_counts_[term_id] > 0 && GetWord(term_id) == word ? term_id : NO_TERM;
+}
+
+void TermDictionary::Save(SnapshotWriter& writer) const {
+    std::string text;
+    std::vector<uint64_t> word_offsets(1, 0);
+    word_offsets.reserve(document_counts_.size() + 1);
+    size_t word_count = 0;
+    for (uint32_t term_id = 0; term_id < document_counts_.size(); ++term_id) {
+        if (document_counts_[term_id] > 0) {
+            text += GetWord(term_id);
+            ++word_count;
+        }
+        word_offsets.push_back(text.size());
+    }
+    // at most half of the slots are taken, so a missing word is found out after a few probes
+    size_t slot_count = 1;
+    while (slot_count < word_count * 2) {
+        slot_count *= 2;
+    }
+    std::vector<uint32_t> term_slots(slot_count, NO_TERM);
+    for (uint32_t term_id = 0; term_id < document_counts_.size(); ++term_id) {
+        if (document_counts_[term_id] > 0) {
+            size_t slot = HashWord(GetWord(term_id)) & (slot_count - 1);
+            while (term_slots[slot] != NO_TERM) {
+                slot = (slot + 1) & (slot_count - 1);
+            }
+            term_slots[slot] = term_id;
+        }
+    }
+    writer.WriteString(text);
+    writer.WriteArray(word_offsets);
+    writer.WriteArray(term_slots);
+    writer.WriteArray(document_counts_);
+    writer.WriteArray(free_term_ids_);
+}
+
+void TermDictionary::Load(SnapshotReader& reader) {
+    term_ids_.clear();
+    words_.clear();
+    snapshot_text_ = reader.ReadString();
+    reader.ReadArray(snapshot_word_offsets_);
+    reader.ReadArray(snapshot_term_slots_);
+    reader.ReadArray(document_counts_);
+    reader.ReadArray(free_term_ids_);
+    const size_t term_id_count = document_counts_.size();
+    const size_t slot_count = snapshot_term_slots_.size();
+    if (term_id_count >= NO_TERM || snapshot_word_offsets_.size() != term_id_count + 1 || snapshot_word_offsets_[0] != 0
+        || snapshot_word_offsets_.back() > snapshot_text_.size() || slot_count == 0 || (slot_count & (slot_count - 1)) != 0) {
+        SnapshotReader::ThrowCorrupted();
+    }
+    for (size_t term_id = 0; term_id < term_id_count; ++term_id) {
+        if (snapshot_word_offsets_[term_id] > snapshot_word_offsets_[term_id + 1] || document_counts_[term_id] < 0) {
+            SnapshotReader::ThrowCorrupted();
+        }
+    }
+    // an empty slot ends every probe
+    bool has_empty_slot = false;
+    for (const uint32_t term_id : snapshot_term_slots_) {
+        if (term_id == NO_TERM) {
+            has_empty_slot = true;
+        }
+        else if (term_id >= term_id_count) {
+            SnapshotReader::ThrowCorrupted();
+        }
+    }
+    if (!has_empty_slot) {
+        SnapshotReader::ThrowCorrupted();
+    }
+    for (const uint32_t term_id : free_term_ids_) {
+        if (term_id >= term_id_count || document_counts_[term_id] != 0) {
+            SnapshotReader::ThrowCorrupted();
+        }
+    }
+}
+
+std::string_view TermDictionary::GetSnapshotWord(uint32_t term_id) const {
+    if (static_cast<size_t>(term_id) + 1 >= snapshot_word_offsets_.size()) {
+        return {};
+    }
+    const uint64_t begin = snapshot_word_offsets_[term_id];
+    return snapshot_text_.substr(begin, snapshot_word_offsets_[term_id + 1] - begin);
+}
+
+uint32_t TermDictionary::FindSnapshotWord(std::string_view word) const {
+    if (snapshot_term_slots_.empty()) {
+        return NO_TERM;
+    }
+    const size_t mask = snapshot_term_slots_.size() - 1;
+    for (size_t slot = HashWord(word) & mask; snapshot_term_slots_[slot] != NO_TERM; slot = (slot + 1) & mask) {
+        if (GetSnapshotWord(snapshot_term_slots_[slot]) == word) {
+            return snapshot_term_slots_[slot];
+        }
+    }
+    return NO_TERM;
+}
+
+uint64_t TermDictionary::HashWord(std::string_view word) {
+    // FNV-1a: unlike std::hash, it is the same for every build that reads the snapshot
+    uint64_t hash = 0xcbf29ce484222325;
+    for (const char c : word) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3;
+    }
+    return hash;
+}
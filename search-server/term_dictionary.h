@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "snapshot.h"
+#include "text_arena.h"
+
+// A word of a document with its term frequency
+struct TermFreq {
+    uint32_t term_id;
+    double term_freq;
+};
+
+// Words of the index numbered by dense ids. Every word is stored once; an id is taken
+// by the first document containing the word and freed, to be reused, with the last one.
+// A loaded dictionary keeps its words in the snapshot and finds them through a hash table saved with them;
+// only the words added after loading go to the arena and to the in-memory map
+class TermDictionary {
+public:
+    static constexpr uint32_t NO_TERM = UINT32_MAX;
+
+    TermDictionary() = default;
+    // The copy stores the in-memory words in an arena of its own and shares the snapshot
+    TermDictionary(const TermDictionary& other);
+    TermDictionary& operator=(const TermDictionary& other);
+    TermDictionary(TermDictionary&&) = default;
+    TermDictionary& operator=(TermDictionary&&) = default;
+
+    // Id of the word, which now has document_count more documents
+    uint32_t Acquire(std::string_view word, int document_count = 1);
+
+    // One document less for the term; the word goes away with its last document
+    void Release(uint32_t term_id);
+
+    // NO_TERM if no document contains the word
+    uint32_t Find(std::string_view word) const;
+
+    // term_id must be in use
+    std::string_view GetWord(uint32_t term_id) const {
+        return term_id < words_.size() && !words_[term_id].empty() ? words_[term_id] : GetSnapshotWord(term_id);
+    }
+
+    int GetDocumentCount(uint32_t term_id) const {
+        return document_counts_[term_id];
+    }
+
+    // Number of ids given out, in use or free
+    size_t GetTermIdCount() const {
+        return document_counts_.size();
+    }
+
+    ArenaMemoryUsage GetMemoryUsage() const {
+        return arena_.GetMemoryUsage();
+    }
+
+    // Throws std::runtime_error if the loaded arrays do not fit together
+    void Save(SnapshotWriter& writer) const;
+    void Load(SnapshotReader& reader);
+
+private:
+    // words added since loading, indexed by id; an empty word is one left in the snapshot
+    std::unordered_map<std::string_view, uint32_t> term_ids_;
+    std::vector<std::string_view> words_;
+    SnapshotArray<int> document_counts_;
+    SnapshotArray<uint32_t> free_term_ids_;
+    TextArena arena_;
+    // The word of id i is snapshot_text_[snapshot_word_offsets_[i], snapshot_word_offsets_[i + 1]).
+    // snapshot_term_slots_ is a linear-probing table of the ids by the hash of the word, with NO_TERM in the empty slots
+    std::string_view snapshot_text_;
+    SnapshotArray<uint64_t> snapshot_word_offsets_;
+    SnapshotArray<uint32_t> snapshot_term_slots_;
+
+    std::string_view GetSnapshotWord(uint32_t term_id) const;
+
+    // Id of the word in the snapshot, whether or not it is still in use
+    uint32_t FindSnapshotWord(std::string_view word) const;
+
+    static uint64_t HashWord(std::string_view word);
+};
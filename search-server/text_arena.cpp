@@ -0,0 +1,85 @@
+#include "text_arena.h"
+#include <cstring>
+#include <functional>
+
+std::string_view TextArena::Store(std::string_view text) {
+    if (text.empty()) {
+        return {};
+    }
+    Chunk* chunk = nullptr;
+    if (text.size() > chunk_size_) {
+        chunk = &AddChunk(text.size());
+    }
+    else {
+        const auto current = chunks_.find(current_);
+        if (current != chunks_.end() && current->second.size - current->second.used >= text.size()) {
+            chunk = &current->second;
+        }
+        else {
+            chunk = &AddChunk(chunk_size_);
+            current_ = chunk->data.get();
+        }
+    }
+    char* data = chunk->data.get() + chunk->used;
+    std::memcpy(data, text.data(), text.size());
+    chunk->used += text.size();
+    chunk->live += text.size();
+    usage_.live_bytes += text.size();
+    return { data, text.size() };
+}
+
+void TextArena::Release(std::string_view text) {
+    if (text.empty()) {
+        return;
+    }
+    const auto iter = FindChunk(text.data());
+    if (iter == chunks_.end()) {
+        return;
+    }
+    Chunk& chunk = iter->second;
+    chunk.live -= text.size();
+    usage_.live_bytes -= text.size();
+    if (chunk.live > 0) {
+        return;
+    }
+    if (iter->first == current_) {
+        // keep the chunk being filled, it starts over
+        chunk.used = 0;
+        return;
+    }
+    usage_.allocated_bytes -= chunk.size;
+    --usage_.chunk_count;
+    chunks_.erase(iter);
+}
+
+bool TextArena::Owns(std::string_view text) const {
+    return !text.empty() && FindChunk(text.data()) != chunks_.end();
+}
+
+std::map<const char*, TextArena::Chunk>::iterator TextArena::FindChunk(const char* data) {
+    auto iter = chunks_.upper_bound(data);
+    if (iter == chunks_.begin()) {
+        return chunks_.end();
+    }
+    --iter;
+    return std::less<>()(data, iter->first + iter->second.size) ? iter : chunks_.end();
+}
+
+std::map<const char*, TextArena::Chunk>::const_iterator TextArena::FindChunk(const char* data) const {
+    auto iter = chunks_.upper_bound(data);
+    if (iter == chunks_.begin()) {
+        return chunks_.end();
+    }
+    --iter;
+    return std::less<>()(data, iter->first + iter->second.size) ? iter : chunks_.end();
+}
+
+TextArena::Chunk& TextArena::AddChunk(size_t size) {
+    Chunk chunk;
+    chunk.data.reset(new char[size]);
+    chunk.size = size;
+    usage_.allocated_bytes += size;
+    ++usage_.chunk_count;
+    const char* key = chunk.data.get();
+    return chunks_.emplace(key, std::move(chunk)).first->second;
+}
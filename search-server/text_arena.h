@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <string_view>
+
+struct ArenaMemoryUsage {
+    // memory held by the chunks
+    size_t allocated_bytes = 0;
+    // bytes of the strings that have not been released
+    size_t live_bytes = 0;
+    size_t chunk_count = 0;
+};
+
+// Stores strings one after another in large chunks, so that a string costs no allocation of its own.
+// A stored string never moves; a chunk is freed as soon as every string in it has been released
+class TextArena {
+public:
+    static constexpr size_t DEFAULT_CHUNK_SIZE = 64 * 1024;
+
+    explicit TextArena(size_t chunk_size = DEFAULT_CHUNK_SIZE)
+        : chunk_size_(chunk_size) {
+    }
+
+    // Strings longer than a chunk get a chunk of their own
+    std::string_view Store(std::string_view text);
+
+    // text must be a string returned by Store; strings stored elsewhere are ignored
+    void Release(std::string_view text);
+
+    bool Owns(std::string_view text) const;
+
+    ArenaMemoryUsage GetMemoryUsage() const {
+        return usage_;
+    }
+
+private:
+    struct Chunk {
+        std::unique_ptr<char[]> data;
+        size_t size = 0;
+        size_t used = 0;
+        size_t live = 0;
+    };
+
+    size_t chunk_size_;
+    // keyed by the start of the chunk, to find the chunk of a string
+    std::map<const char*, Chunk> chunks_;
+    // the chunk new strings are appended to
+    const char* current_ = nullptr;
+    ArenaMemoryUsage usage_;
+
+    std::map<const char*, Chunk>::iterator FindChunk(const char* data);
+    std::map<const char*, Chunk>::const_iterator FindChunk(const char* data) const;
+
+    Chunk& AddChunk(size_t size);
+};
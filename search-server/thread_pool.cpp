@@ -0,0 +1,131 @@
+#include "thread_pool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t worker_count)
+    : worker_count_(std::max<size_t>(1, worker_count)) {
+    for (size_t i = 0; i < worker_count_; ++i) {
+        queues_.push_back(std::make_unique<Queue>());
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard guard(wake_mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+void ThreadPool::Run(void (*run)(void*, size_t, size_t), void* function, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    std::call_once(start_flag_, [this] {
+        Start();
+    });
+
+    Batch batch;
+    batch.run = run;
+    batch.function = function;
+    // a few ranges per worker, so that the ones that finish early have something to steal
+    const size_t range_count = std::min(count, worker_count_ * 4);
+    batch.pending_ranges = range_count;
+    {
+        // a worker takes wake_mutex_ to count a taken range off, so it can only do that after
+        // the ranges are counted in; the queue locks are never held while waiting for wake_mutex_
+        std::lock_guard wake_guard(wake_mutex_);
+        for (size_t i = 0; i < range_count; ++i) {
+            Queue& queue = *queues_[i % queues_.size()];
+            std::lock_guard guard(queue.mutex);
+            queue.ranges.push_back({ &batch, count * i / range_count, count * (i + 1) / range_count });
+        }
+        queued_ranges_ += range_count;
+    }
+    wake_.notify_all();
+
+    Range range;
+    while (batch.pending_ranges.load() > 0 && TryTake(queues_.size() - 1, range)) {
+        Execute(range);
+    }
+    std::unique_lock lock(batch.mutex);
+    batch.done.wait(lock, [&batch] {
+        return batch.pending_ranges.load() == 0;
+    });
+    if (batch.exception) {
+        std::rethrow_exception(batch.exception);
+    }
+}
+
+void ThreadPool::Start() {
+    for (size_t i = 0; i + 1 < worker_count_; ++i) {
+        threads_.emplace_back([this, i] {
+            WorkerLoop(i);
+        });
+    }
+}
+
+void ThreadPool::WorkerLoop(size_t queue_index) {
+    Range range;
+    while (true) {
+        if (TryTake(queue_index, range)) {
+            Execute(range);
+            continue;
+        }
+        std::unique_lock lock(wake_mutex_);
+        wake_.wait(lock, [this] {
+            return stopping_ || queued_ranges_ > 0;
+        });
+        if (stopping_ && queued_ranges_ == 0) {
+            return;
+        }
+    }
+}
+
+bool ThreadPool::TryTake(size_t queue_index, Range& range) {
+    bool is_taken = false;
+    {
+        Queue& own = *queues_[queue_index];
+        std::lock_guard guard(own.mutex);
+        if (!own.ranges.empty()) {
+            range = own.ranges.front();
+            own.ranges.pop_front();
+            is_taken = true;
+        }
+    }
+    for (size_t i = 1; !is_taken && i < queues_.size(); ++i) {
+        Queue& victim = *queues_[(queue_index + i) % queues_.size()];
+        std::lock_guard guard(victim.mutex);
+        if (!victim.ranges.empty()) {
+            range = victim.ranges.back();
+            victim.ranges.pop_back();
+            is_taken = true;
+        }
+    }
+    if (is_taken) {
+        std::lock_guard guard(wake_mutex_);
+        --queued_ranges_;
+    }
+    return is_taken;
+}
+
+void ThreadPool::Execute(const Range& range) {
+    Batch& batch = *range.batch;
+    try {
+        batch.run(batch.function, range.first, range.last);
+    }
+    catch (...) {
+        std::lock_guard guard(batch.mutex);
+        if (!batch.exception) {
+            batch.exception = std::current_exception();
+        }
+    }
+    // the submitter may destroy the batch as soon as it sees no pending ranges,
+    // so the counter is only touched under the batch mutex
+    std::lock_guard guard(batch.mutex);
+    if (--batch.pending_ranges == 0) {
+        batch.done.notify_all();
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed set of worker threads that run batches of indexed tasks.
+// A batch is cut into ranges which are dealt to per-worker queues; a worker takes ranges
+// from the front of its own queue and, once it runs dry, steals from the back of the others.
+// Threads are started on the first batch and live until the pool is destroyed
+class ThreadPool {
+public:
+    // worker_count threads work on a batch, the thread that submitted it included
+    explicit ThreadPool(size_t worker_count);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t GetWorkerCount() const {
+        return worker_count_;
+    }
+
+    // Calls function(i) for every i in [0, count) and returns when all the calls are done.
+    // The first exception thrown by function is rethrown here
+    template <typename Function>
+    void ParallelFor(size_t count, Function&& function);
+
+private:
+    struct Batch {
+        void (*run)(void* function, size_t first, size_t last);
+        void* function;
+        std::atomic<size_t> pending_ranges{ 0 };
+        std::mutex mutex;
+        std::condition_variable done;
+        std::exception_ptr exception;
+    };
+
+    struct Range {
+        Batch* batch;
+        size_t first;
+        size_t last;
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Range> ranges;
+    };
+
+    size_t worker_count_;
+    // one queue per background thread plus one for the submitting threads
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> threads_;
+    std::once_flag start_flag_;
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    size_t queued_ranges_ = 0;
+    bool stopping_ = false;
+
+    void Run(void (*run)(void*, size_t, size_t), void* function, size_t count);
+
+    void Start();
+
+    void WorkerLoop(size_t queue_index);
+
+    // Takes a range from the given queue or steals one from the others
+    bool TryTake(size_t queue_index, Range& range);
+
+    static void Execute(const Range& range);
+};
+
+template <typename Function>
+void ThreadPool::ParallelFor(size_t count, Function&& function) {
+    using FunctionType = std::remove_reference_t<Function>;
+    Run([](void* function, size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+            (*static_cast<FunctionType*>(function))(i);
+        }
+    }, const_cast<std::remove_const_t<FunctionType>*>(std::addressof(function)), count);
+}
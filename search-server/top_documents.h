@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include "document.h"
+
+const double EPSILON = 1e-6;
+
+// Documents with relevance closer than EPSILON are ranked by rating, then by id
+inline bool IsMoreRelevant(const Document& lhs, const Document& rhs) {
+    if (std::abs(lhs.relevance - rhs.relevance) < EPSILON) {
+        if (lhs.rating != rhs.rating) {
+            return lhs.rating > rhs.rating;
+        }
+        return lhs.id < rhs.id;
+    }
+    return lhs.relevance > rhs.relevance;
+}
+
+// Keeps the max_count most relevant of the documents added so far.
+// The documents are stored in a heap with the least relevant one on top,
+// so a candidate that does not make it into the result costs one comparison
+class TopDocuments {
+public:
+    explicit TopDocuments(size_t max_count)
+        : max_count_(max_count) {
+        documents_.reserve(max_count);
+    }
+
+    void Add(const Document& document) {
+        if (documents_.size() < max_count_) {
+            documents_.push_back(document);
+            std::push_heap(documents_.begin(), documents_.end(), IsMoreRelevant);
+        }
+        else if (max_count_ > 0 && IsMoreRelevant(document, documents_.front())) {
+            std::pop_heap(documents_.begin(), documents_.end(), IsMoreRelevant);
+            documents_.back() = document;
+            std::push_heap(documents_.begin(), documents_.end(), IsMoreRelevant);
+        }
+    }
+
+    void Merge(const TopDocuments& other) {
+        for (const Document& document : other.documents_) {
+            Add(document);
+        }
+    }
+
+    size_t GetMaxCount() const {
+        return max_count_;
+    }
+
+    bool IsFull() const {
+        return documents_.size() == max_count_;
+    }
+
+    // The document a candidate has to beat; the container must not be empty
+    const Document& GetWorst() const {
+        return documents_.front();
+    }
+
+    // Returns the documents from the most to the least relevant
+    std::vector<Document> Extract() {
+        std::sort_heap(documents_.begin(), documents_.end(), IsMoreRelevant);
+        return std::move(documents_);
+    }
+
+private:
+    size_t max_count_;
+    std::vector<Document> documents_;
+};